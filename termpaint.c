@@ -9,6 +9,10 @@
 #include <stdint.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "termpaint_compiler.h"
 #include "termpaint_input.h"
 #include "termpaint_utf8.h"
@@ -70,11 +74,19 @@ typedef unsigned char uchar;
  * - foreground color (default or 16 colors (named or bright named)
  *   or 256 color or direct color)
  * - background color (same options as foreground color)
- * - patch (an beginning and ending string of control sequences; 0 no patch else index + 1 of patches array in surface)
+ * - patch (an beginning and ending string of control sequences; 0 no patch else index + 1 into the patch table in
+ *   surface. Patches are reference counted by the styles using them and freed when the incremental style
+ *   garbage collection expires the last of these styles)
+ *
+ * Attributes are not stored in the cells directly. Each distinct combination is interned once in the style
+ * table of the surface and cells only store the index of their style. So equal attributes always have the same
+ * style index. Style 0 is all zero (default colors, no attributes, no patch) and used for freshly allocated cells.
+ * Unused styles are expired by an incremental garbage collection that runs while new styles are added.
  *
  * text_len == 0 && text_overflow == nullptr -> same as ' '
  * text_len == 0 && text_overflow == WIDE_RIGHT_PADDING -> character hidden by multi cell cluster
  * text_len == 1 && text[0] == '\x01', only in cells_last_flush => cell was hidden, will need repaint if start of char.
+ *                                     Not used in double buffered mode, there cells_last_flush is a valid surface.
  *
  * Additional invariants:
  * - The colors and flags (except CELL_SOFTWRAP_MARKER) of all cells in a cluster are identical.
@@ -106,8 +118,8 @@ struct termpaint_attr_ {
 
 #define CELL_ATTR_DECO_MASK CELL_ATTR_UNDERLINE_MASK
 
-#define CELL_SOFTWRAP_MARKER (1 << 15)
-#define CELL_ATTR_MASK ((uint16_t)(~CELL_SOFTWRAP_MARKER))
+// cell flags
+#define CELL_SOFTWRAP_MARKER (1 << 0)
 
 #define TERMPAINT_STYLE_PASSTHROUGH (TERMPAINT_STYLE_BOLD | TERMPAINT_STYLE_ITALIC | TERMPAINT_STYLE_BLINK \
     | TERMPAINT_STYLE_OVERLINE | TERMPAINT_STYLE_INVERSE | TERMPAINT_STYLE_STRIKE)
@@ -115,46 +127,92 @@ struct termpaint_attr_ {
 #define WIDE_RIGHT_PADDING ((termpaint_hash_item*)-1)
 
 typedef struct cell_ {
-    uint32_t fg_color;
-    uint32_t bg_color;
-    uint32_t deco_color;
-    uint16_t flags; // bold, italic, underline[2], blinking, overline, inverse, strikethrough. softwrap marker
-    uint8_t attr_patch_idx;
-
+    uint32_t style; // index into the style table of the surface
+    uint8_t flags; // softwrap marker
     uint8_t cluster_expansion : 4;
     uint8_t text_len : 4; // == 0 -> text_overflow is active or WIDE_RIGHT_PADDING.
+    uint16_t reserved; // always 0, cells are compared bytewise in flush
     union {
         termpaint_hash_item* text_overflow;
         unsigned char text[8];
     };
 } cell;
 
-_Static_assert(sizeof(void*) > 8 || sizeof(cell) == 24, "bad cell size");
+_Static_assert(sizeof(void*) > 8 || sizeof(cell) == 16, "bad cell size");
+
+#define TERMPAINTP_STYLE_NONE UINT32_MAX
+#define TERMPAINTP_STYLE_FREE 0
+#define TERMPAINTP_STYLE_USED 1
+#define TERMPAINTP_STYLE_MARKED 2
+
+typedef struct termpaintp_style_ {
+    uint32_t fg_color;
+    uint32_t bg_color;
+    uint32_t deco_color;
+    uint16_t flags; // bold, italic, underline[2], blinking, overline, inverse, strikethrough
+    uint8_t state;
+    uint32_t patch_idx; // 0 no patch, else index + 1 into the patch table. Each style holds a reference.
+    uint32_t next; // next style in the same hash bucket or in the free list
+    uint32_t displayed; // only primary surface: style as output by flush, TERMPAINTP_STYLE_NONE if not known yet
+} termpaintp_style;
+
+typedef struct termpaintp_style_table_ {
+    termpaintp_style *styles;
+    uint32_t allocated;
+    uint32_t used; // styles [0, used) were handed out at least once
+    uint32_t count;
+    uint32_t free_list;
+    uint32_t *buckets; // allocated entries, TERMPAINTP_STYLE_NONE terminates the chains
+    int gc_blocked; // while > 0 style indices held outside of cells stay valid
+    // incremental garbage collection, see termpaintp_surface_style_gc_step
+    bool gc_active;
+    unsigned gc_pos; // cells before this index (in cells and cells_last_flush) are already marked
+    uint32_t gc_trigger;
+} termpaintp_style_table;
+
+#define TERMPAINTP_PATCH_NONE UINT32_MAX
 
 typedef struct termpaintp_patch_ {
     bool optimize;
 
     uint32_t setup_hash;
-    unsigned char *setup;
+    unsigned char *setup; // nullptr for free entries
 
     uint32_t cleanup_hash;
     unsigned char *cleanup;
 
-    bool unused;
+    // styles using the patch and callers of termpaintp_surface_ensure_patch_idx not done yet. Cells are not counted,
+    // they keep the patch alive through their style.
+    uint32_t refcount;
+    uint32_t next; // next patch in the same hash bucket or in the free list
 } termpaintp_patch;
 
+typedef struct termpaintp_patch_table_ {
+    termpaintp_patch *patches;
+    uint32_t allocated; // power of two, also the number of buckets
+    uint32_t used; // patches [0, used) were handed out at least once
+    uint32_t free_list;
+    uint32_t *buckets; // allocated entries, TERMPAINTP_PATCH_NONE terminates the chains
+} termpaintp_patch_table;
+
 struct termpaint_surface_ {
     termpaint_terminal *terminal;
 
     bool primary;
     cell* cells;
     cell* cells_last_flush;
+    bool* dirty_rows; // only primary surface: rows changed since the last flush
     unsigned cells_allocated;
     int width;
     int height;
 
     termpaint_hash overflow_text;
-    termpaintp_patch *patches;
+    // incremental garbage collection of overflow_text, see termpaintp_surface_overflow_gc_step
+    bool overflow_gc_active;
+    unsigned overflow_gc_pos; // cells before this index (in cells and cells_last_flush) are already marked
+    int overflow_gc_trigger;
+    termpaintp_patch_table patches;
+    termpaintp_style_table styles;
 };
 
 typedef enum auto_detect_state_ {
@@ -259,9 +317,30 @@ typedef struct termpaint_integration_private_ {
     void (*awaiting_response)(struct termpaint_integration_ *integration);
     void (*restore_sequence_updated)(struct termpaint_integration_ *integration, const char *data, int length);
     void (*logging_func)(struct termpaint_integration_ *integration, const char *data, int length);
+    int64_t (*monotonic_clock_ns)(struct termpaint_integration_ *integration);
 } termpaint_integration_private;
 
-#define NUM_CAPABILITIES 15
+#define NUM_CAPABILITIES 19
+
+#define TERMPAINTP_DEFAULT_OUTPUT_BUFFER_SIZE 65536
+
+#define TERMPAINTP_SGR_CACHE_SIZE 256
+#define TERMPAINTP_SGR_CACHE_MAX_LEN 59
+
+// Encoded SGR sequence for a transition between two attribute sets (old bg, fg, deco, flags, new bg, fg, deco, flags).
+// Old attributes are all -1 when they are not known.
+typedef struct termpaintp_sgr_cache_entry_ {
+    uint32_t key[8];
+    unsigned char len; // 0 -> unused
+    char data[TERMPAINTP_SGR_CACHE_MAX_LEN];
+} termpaintp_sgr_cache_entry;
+
+#define TERMPAINTP_QUANTIZE_CACHE_BITS 12
+
+typedef struct termpaintp_quantize_cache_entry_ {
+    uint32_t color; // 0 -> unused, only rgb colors are cached
+    uint32_t quantized;
+} termpaintp_quantize_cache_entry;
 
 typedef struct termpaint_terminal_ {
     termpaint_integration *integration;
@@ -269,6 +348,11 @@ typedef struct termpaint_terminal_ {
     termpaint_surface primary;
     termpaint_input *input;
     bool force_full_repaint;
+    bool double_buffered; // cells_last_flush holds unmodified cells and is swapped with cells after a full flush
+    int output_rate; // bytes per second, 0 if unknown or not limited
+    int low_bandwidth_threshold; // 0 disables degradation
+    int low_bandwidth_recover_count;
+    bool low_bandwidth; // flush degrades colors to save bandwidth
     bool data_pending_after_input_received : 1;
     bool request_repaint : 1;
     termpaint_str auto_detect_sec_device_attributes;
@@ -313,6 +397,18 @@ typedef struct termpaint_terminal_ {
     termpaint_color_entry *colors_dirty;
 
     termpaint_str restore_seq;
+
+    termpaint_str output_buffer;
+    unsigned output_buffer_size;
+    bool output_buffering;
+    termpaint_str captured_output;
+    bool capture_output;
+
+    termpaint_flush_stats flush_stats;
+    int *flush_stats_bytes; // byte counter of the current output category while flushing, nullptr otherwise
+    void (*flush_stats_cb)(void *, const termpaint_flush_stats *);
+    void *flush_stats_user_data;
+
     auto_detect_state ad_state;
     // additional auto detect state machine temporary space
     int glitch_cursor_x;
@@ -322,6 +418,8 @@ typedef struct termpaint_terminal_ {
     // </>
     bool capabilities[NUM_CAPABILITIES];
     int max_csi_parameters;
+    termpaintp_sgr_cache_entry *sgr_cache; // allocated on first use
+    termpaintp_quantize_cache_entry *quantize_cache; // allocated on first use
 } termpaint_terminal;
 
 typedef enum termpaint_text_measurement_state_ {
@@ -654,17 +752,91 @@ _tERMPAINT_PUBLIC void termpaint_integration_set_logging_func(termpaint_integrat
     integration->p->logging_func = logging_func;
 }
 
+_tERMPAINT_PUBLIC void termpaint_integration_set_monotonic_clock_ns(termpaint_integration *integration, int64_t (*monotonic_clock_ns)(termpaint_integration *integration)) {
+    integration->p->monotonic_clock_ns = monotonic_clock_ns;
+}
+
 void termpaint_integration_deinit(termpaint_integration *integration) {
     free(integration->p);
     integration->p = nullptr;
 }
 
+#define TERMPAINTP_STYLE_TABLE_INITIAL_SIZE 64
+
+static inline termpaintp_style *termpaintp_surface_style(const termpaint_surface *surface, uint32_t style) {
+    return &surface->styles.styles[style];
+}
+
+static inline uint32_t termpaintp_style_hash(uint32_t fg, uint32_t bg, uint32_t deco, uint16_t flags,
+                                             uint32_t patch_idx) {
+    uint32_t hash = fg * 0x9e3779b1u;
+    hash = (hash ^ bg) * 0x85ebca77u;
+    hash = (hash ^ deco) * 0xc2b2ae3du;
+    hash = (hash ^ flags) * 0x27d4eb2fu;
+    hash = (hash ^ patch_idx) * 0x165667b1u;
+    return hash ^ (hash >> 15);
+}
+
+static void termpaintp_style_table_rebuild_buckets(termpaintp_style_table *table) {
+    const uint32_t mask = table->allocated - 1;
+    for (uint32_t i = 0; i < table->allocated; i++) {
+        table->buckets[i] = TERMPAINTP_STYLE_NONE;
+    }
+    for (uint32_t i = 0; i < table->used; i++) {
+        termpaintp_style *entry = &table->styles[i];
+        if (entry->state == TERMPAINTP_STYLE_FREE) {
+            continue;
+        }
+        uint32_t bucket = termpaintp_style_hash(entry->fg_color, entry->bg_color, entry->deco_color,
+                                                entry->flags, entry->patch_idx) & mask;
+        entry->next = table->buckets[bucket];
+        table->buckets[bucket] = i;
+    }
+}
+
+static bool termpaintp_style_table_grow_mustcheck(termpaintp_style_table *table) {
+    uint32_t new_allocated = table->allocated ? table->allocated * 2 : TERMPAINTP_STYLE_TABLE_INITIAL_SIZE;
+    // also keeps the size in bytes below 2GB for 32bit systems
+    if (new_allocated > (UINT32_MAX / 2) / sizeof(termpaintp_style)) {
+        return false;
+    }
+    termpaintp_style *new_styles = realloc(table->styles, new_allocated * sizeof(termpaintp_style));
+    if (!new_styles) {
+        return false;
+    }
+    table->styles = new_styles;
+    uint32_t *new_buckets = realloc(table->buckets, new_allocated * sizeof(uint32_t));
+    if (!new_buckets) {
+        // keep the old bucket array, styles is just larger than needed
+        return false;
+    }
+    table->buckets = new_buckets;
+    table->allocated = new_allocated;
+    if (table->used == 0) {
+        // style 0 is the all default style used by freshly allocated cells
+        memset(&table->styles[0], 0, sizeof(termpaintp_style));
+        table->styles[0].state = TERMPAINTP_STYLE_USED;
+        table->styles[0].displayed = TERMPAINTP_STYLE_NONE;
+        table->used = 1;
+        table->count = 1;
+        table->free_list = TERMPAINTP_STYLE_NONE;
+    }
+    termpaintp_style_table_rebuild_buckets(table);
+    return true;
+}
+
+static void termpaintp_surface_overflow_gc_reset(termpaint_surface *surface) {
+    surface->overflow_gc_active = false;
+    surface->overflow_gc_pos = 0;
+}
+
 static void termpaintp_collapse(termpaint_surface *surface) {
     surface->width = 0;
     surface->height = 0;
     surface->cells_allocated = 0;
     surface->cells = nullptr;
     surface->cells_last_flush = nullptr;
+    surface->dirty_rows = nullptr;
 }
 
 static bool termpaintp_resize_mustcheck(termpaint_surface *surface, int width, int height) {
@@ -683,27 +855,46 @@ static bool termpaintp_resize_mustcheck(termpaint_surface *surface, int width, i
         int_debuglog_printf(surface->terminal, "surface resize: Invalid size %dx%d, collapsing surface.", width, height);
         free(surface->cells);
         free(surface->cells_last_flush);
+        free(surface->dirty_rows);
         termpaintp_collapse(surface);
         return true; // This is debatable, but the previous code did allow this and there are tests for this.
     }
     surface->cells_allocated = cell_count;
     free(surface->cells);
     free(surface->cells_last_flush);
+    free(surface->dirty_rows);
+    // no cell refers to overflow text anymore
+    termpaintp_hash_clear(&surface->overflow_text);
+    termpaintp_surface_overflow_gc_reset(surface);
+    // leftover marks just keep styles one more collection
+    surface->styles.gc_active = false;
     surface->cells_last_flush = nullptr;
+    surface->dirty_rows = nullptr;
     surface->cells = calloc(1, bytes);
     if (!surface->cells) {
         termpaintp_collapse(surface);
         return false;
     }
+    if (!surface->styles.allocated && !termpaintp_style_table_grow_mustcheck(&surface->styles)) {
+        free(surface->cells);
+        termpaintp_collapse(surface);
+        return false;
+    }
 
     if (surface->primary) {
         surface->terminal->force_full_repaint = true;
         surface->cells_last_flush = calloc(1, surface->cells_allocated * sizeof(cell));
-        if (!surface->cells_last_flush) {
+        surface->dirty_rows = malloc(height ? height * sizeof(bool) : 1);
+        if (!surface->cells_last_flush || !surface->dirty_rows) {
             free(surface->cells);
+            free(surface->cells_last_flush);
+            free(surface->dirty_rows);
             termpaintp_collapse(surface);
             return false;
         }
+        for (int y = 0; y < height; y++) {
+            surface->dirty_rows[y] = true;
+        }
     }
     return true;
 }
@@ -719,6 +910,22 @@ static inline cell* termpaintp_getcell(const termpaint_surface *surface, int x,
     }
 }
 
+// Marks rows [y0, y1] as changed since the last flush. Rows outside of the surface are ignored.
+static inline void termpaintp_surface_mark_rows_dirty(const termpaint_surface *surface, int y0, int y1) {
+    if (!surface->dirty_rows) {
+        return;
+    }
+    if (y0 < 0) {
+        y0 = 0;
+    }
+    if (y1 >= surface->height) {
+        y1 = surface->height - 1;
+    }
+    for (int y = y0; y <= y1; y++) {
+        surface->dirty_rows[y] = true;
+    }
+}
+
 static inline cell* termpaintp_getcell_or_null(const termpaint_surface *surface, int x, int y) {
     unsigned index = y*surface->width + x;
     if (x >= 0 && y >= 0
@@ -733,11 +940,72 @@ static inline cell* termpaintp_getcell_or_null(const termpaint_surface *surface,
     }
 }
 
+#define TERMPAINTP_OVERFLOW_GC_MIN_TRIGGER 64
+
+static inline void termpaintp_overflow_gc_mark_cell(const cell *c) {
+    if (c->text_len == 0 && c->text_overflow != nullptr && c->text_overflow != WIDE_RIGHT_PADDING) {
+        c->text_overflow->unused = false;
+    }
+}
+
+// Marks the overflow text of cells in [begin, end) of cells and cells_last_flush as in use. Needed when cells are
+// moved to a different index while a collection is active.
+static void termpaintp_surface_overflow_gc_mark_range(termpaint_surface *surface, const cell *cells,
+                                                      unsigned begin, unsigned end) {
+    if (!surface->overflow_gc_active) {
+        return;
+    }
+    for (unsigned i = begin; i < end; i++) {
+        termpaintp_overflow_gc_mark_cell(&cells[i]);
+    }
+}
+
+// Garbage collection of overflow text is spread over the calls that store overflow text in cells, so no call has to
+// scan the whole surface. A collection starts when the hash got large enough. Each call then marks the next part of
+// the cells, sized so that the collection finishes before the hash could grow to twice the trigger size. Cells that
+// get overflow text while the collection is active mark it directly. Cells are not moved to a different index
+// except for scrolling in flush, which marks the moved cells itself.
+static void termpaintp_surface_overflow_gc_step(termpaint_surface *surface) {
+    termpaint_hash *hash = &surface->overflow_text;
+    if (!surface->overflow_gc_active) {
+        if (surface->overflow_gc_trigger < TERMPAINTP_OVERFLOW_GC_MIN_TRIGGER) {
+            surface->overflow_gc_trigger = TERMPAINTP_OVERFLOW_GC_MIN_TRIGGER;
+        }
+        if (hash->count < surface->overflow_gc_trigger) {
+            return;
+        }
+        termpaintp_hash_gc_begin(hash);
+        surface->overflow_gc_active = true;
+        surface->overflow_gc_pos = 0;
+    }
+
+    const unsigned cell_count = surface->width * surface->height;
+    const unsigned budget = cell_count / (surface->overflow_gc_trigger / 2) + 1;
+    unsigned end = surface->overflow_gc_pos + budget;
+    if (end > cell_count) {
+        end = cell_count;
+    }
+    for (unsigned i = surface->overflow_gc_pos; i < end; i++) {
+        termpaintp_overflow_gc_mark_cell(&surface->cells[i]);
+        if (surface->cells_last_flush) {
+            termpaintp_overflow_gc_mark_cell(&surface->cells_last_flush[i]);
+        }
+    }
+    surface->overflow_gc_pos = end;
+
+    if (end == cell_count) {
+        termpaintp_hash_gc_sweep(hash);
+        surface->overflow_gc_active = false;
+        surface->overflow_gc_trigger = hash->count * 2;
+    }
+}
+
 static void termpaintp_set_overflow_text(termpaint_surface *surface, cell *dst_cell, const unsigned char* data) {
-    // hash_ensure needs to be done before touching text_len, because it can cause garbage collection which would
-    // see an inconistant state if text_len is already set to zero.
-    void* overflow_ptr = termpaintp_hash_ensure(&surface->overflow_text, data);
-    if (!overflow_ptr) {
+    termpaint_hash_item* overflow_ptr = termpaintp_hash_ensure(&surface->overflow_text, data);
+    if (overflow_ptr) {
+        // might have been marked unused by an active collection
+        overflow_ptr->unused = false;
+    } else {
         if (!surface->terminal->glitch_on_oom) {
             termpaintp_oom(surface->terminal);
         } else {
@@ -748,33 +1016,129 @@ static void termpaintp_set_overflow_text(termpaint_surface *surface, cell *dst_c
     }
     dst_cell->text_len = 0;
     dst_cell->text_overflow = overflow_ptr;
+    termpaintp_surface_overflow_gc_step(surface);
 }
 
 static void termpaintp_surface_destroy(termpaint_surface *surface) {
     free(surface->cells);
     free(surface->cells_last_flush);
+    free(surface->dirty_rows);
     termpaintp_hash_destroy(&surface->overflow_text);
+    free(surface->styles.styles);
+    free(surface->styles.buckets);
+    memset(&surface->styles, 0, sizeof(surface->styles));
 
-    if (surface->patches) {
-        for (int i = 0; i < 255; ++i) {
-            free(surface->patches[i].setup);
-            free(surface->patches[i].cleanup);
-        }
-        free(surface->patches);
-        surface->patches = nullptr;
+    for (uint32_t i = 0; i < surface->patches.used; ++i) {
+        free(surface->patches.patches[i].setup);
+        free(surface->patches.patches[i].cleanup);
     }
+    free(surface->patches.patches);
+    free(surface->patches.buckets);
+    memset(&surface->patches, 0, sizeof(surface->patches));
     termpaintp_collapse(surface);
 }
 
-static uint8_t termpaintp_surface_ensure_patch_idx(termpaint_surface *surface, bool optimize, unsigned char *setup,
-                                                unsigned char *cleanup) {
+static inline termpaintp_patch *termpaintp_surface_patch(const termpaint_surface *surface, uint32_t patch_idx) {
+    return &surface->patches.patches[patch_idx - 1];
+}
+
+static inline uint32_t termpaintp_patch_bucket(const termpaintp_patch_table *table, uint32_t setup_hash,
+                                               uint32_t cleanup_hash) {
+    return ((setup_hash * 0x9e3779b1u) ^ cleanup_hash) & (table->allocated - 1);
+}
+
+static bool termpaintp_patch_table_grow_mustcheck(termpaintp_patch_table *table) {
+    uint32_t new_allocated = table->allocated ? table->allocated * 2 : 16;
+    // also keeps the size in bytes below 2GB for 32bit systems
+    if (new_allocated > (UINT32_MAX / 2) / sizeof(termpaintp_patch)) {
+        return false;
+    }
+    termpaintp_patch *new_patches = realloc(table->patches, new_allocated * sizeof(termpaintp_patch));
+    if (!new_patches) {
+        return false;
+    }
+    table->patches = new_patches;
+    uint32_t *new_buckets = realloc(table->buckets, new_allocated * sizeof(uint32_t));
+    if (!new_buckets) {
+        return false;
+    }
+    table->buckets = new_buckets;
+    if (!table->allocated) {
+        table->free_list = TERMPAINTP_PATCH_NONE;
+    }
+    table->allocated = new_allocated;
+
+    for (uint32_t i = 0; i < table->allocated; i++) {
+        table->buckets[i] = TERMPAINTP_PATCH_NONE;
+    }
+    for (uint32_t i = 0; i < table->used; i++) {
+        termpaintp_patch *patch = &table->patches[i];
+        if (patch->setup) {
+            uint32_t bucket = termpaintp_patch_bucket(table, patch->setup_hash, patch->cleanup_hash);
+            patch->next = table->buckets[bucket];
+            table->buckets[bucket] = i;
+        }
+    }
+    return true;
+}
+
+static void termpaintp_surface_patch_ref(termpaint_surface *surface, uint32_t patch_idx) {
+    if (patch_idx) {
+        termpaintp_surface_patch(surface, patch_idx)->refcount++;
+    }
+}
+
+static void termpaintp_surface_patch_unref(termpaint_surface *surface, uint32_t patch_idx) {
+    if (!patch_idx) {
+        return;
+    }
+    termpaintp_patch_table *table = &surface->patches;
+    termpaintp_patch *patch = termpaintp_surface_patch(surface, patch_idx);
+    if (--patch->refcount) {
+        return;
+    }
+    uint32_t *link = &table->buckets[termpaintp_patch_bucket(table, patch->setup_hash, patch->cleanup_hash)];
+    while (*link != patch_idx - 1) {
+        link = &table->patches[*link].next;
+    }
+    *link = patch->next;
+    free(patch->setup);
+    free(patch->cleanup);
+    patch->setup = nullptr;
+    patch->cleanup = nullptr;
+    patch->next = table->free_list;
+    table->free_list = patch_idx - 1;
+}
+
+// Returns the index of the patch (index + 1 into the patch table, 0 for no patch) and adds a reference to it that
+// the caller has to release with termpaintp_surface_patch_unref after using it in a style.
+static uint32_t termpaintp_surface_ensure_patch_idx(termpaint_surface *surface, bool optimize, unsigned char *setup,
+                                                    unsigned char *cleanup) {
     if (!setup || !cleanup) {
         return 0;
     }
 
-    if (!surface->patches) {
-        surface->patches = calloc(255, sizeof(termpaintp_patch));
-        if (!surface->patches) {
+    termpaintp_patch_table *table = &surface->patches;
+    uint32_t setup_hash = termpaintp_hash_string(setup);
+    uint32_t cleanup_hash = termpaintp_hash_string(cleanup);
+
+    if (table->allocated) {
+        uint32_t i = table->buckets[termpaintp_patch_bucket(table, setup_hash, cleanup_hash)];
+        while (i != TERMPAINTP_PATCH_NONE) {
+            termpaintp_patch *patch = &table->patches[i];
+            if (patch->setup_hash == setup_hash
+                    && patch->cleanup_hash == cleanup_hash
+                    && ustrcmp(setup, patch->setup) == 0
+                    && ustrcmp(cleanup, patch->cleanup) == 0) {
+                patch->refcount++;
+                return i + 1;
+            }
+            i = patch->next;
+        }
+    }
+
+    if (!table->allocated || (table->free_list == TERMPAINTP_PATCH_NONE && table->used == table->allocated)) {
+        if (!termpaintp_patch_table_grow_mustcheck(table)) {
             if (!surface->terminal->glitch_on_oom) {
                 termpaintp_oom(surface->terminal);
             } else {
@@ -784,86 +1148,190 @@ static uint8_t termpaintp_surface_ensure_patch_idx(termpaint_surface *surface, b
         }
     }
 
-    uint32_t setup_hash = termpaintp_hash_fnv1a(setup);
-    uint32_t cleanup_hash = termpaintp_hash_fnv1a(cleanup);
+    unsigned char *setup_copy = ustrdup(setup);
+    unsigned char *cleanup_copy = ustrdup(cleanup);
+    if (!setup_copy || !cleanup_copy) {
+        if (!surface->terminal->glitch_on_oom) {
+            termpaintp_oom(surface->terminal);
+        } else {
+            free(setup_copy);
+            free(cleanup_copy);
+            termpaintp_oom_log_only(surface->terminal);
+            return 0;
+        }
+    }
+
+    uint32_t free_slot;
+    if (table->free_list != TERMPAINTP_PATCH_NONE) {
+        free_slot = table->free_list;
+        table->free_list = table->patches[free_slot].next;
+    } else {
+        free_slot = table->used++;
+    }
+    termpaintp_patch *patch = &table->patches[free_slot];
+    patch->optimize = optimize;
+    patch->setup_hash = setup_hash;
+    patch->cleanup_hash = cleanup_hash;
+    patch->setup = setup_copy;
+    patch->cleanup = cleanup_copy;
+    patch->refcount = 1;
+    uint32_t bucket = termpaintp_patch_bucket(table, setup_hash, cleanup_hash);
+    patch->next = table->buckets[bucket];
+    table->buckets[bucket] = free_slot;
+    return free_slot + 1;
+}
 
-    int free_slot = -1;
+#define TERMPAINTP_STYLE_GC_MIN_TRIGGER TERMPAINTP_STYLE_TABLE_INITIAL_SIZE
 
-    for (int i = 0; i < 255; ++i) {
-        if (!surface->patches[i].setup) {
-            if (free_slot == -1) {
-                free_slot = i;
+static inline void termpaintp_style_table_gc_mark(termpaintp_style_table *table, uint32_t style) {
+    if (table->gc_active) {
+        table->styles[style].state = TERMPAINTP_STYLE_MARKED;
+    }
+}
+
+// Marks the styles of cells in [begin, end) of cells and cells_last_flush as in use. Needed when cells are
+// moved to a different index while a collection is active.
+static void termpaintp_surface_style_gc_mark_range(termpaint_surface *surface, const cell *cells,
+                                                   unsigned begin, unsigned end) {
+    if (!surface->styles.gc_active) {
+        return;
+    }
+    for (unsigned i = begin; i < end; i++) {
+        surface->styles.styles[cells[i].style].state = TERMPAINTP_STYLE_MARKED;
+    }
+}
+
+static void termpaintp_surface_style_gc_sweep(termpaint_surface *surface) {
+    termpaintp_style_table *table = &surface->styles;
+    table->styles[0].state = TERMPAINTP_STYLE_MARKED;
+
+    table->free_list = TERMPAINTP_STYLE_NONE;
+    table->count = 0;
+    for (uint32_t i = table->used; i > 0; i--) {
+        termpaintp_style *entry = &table->styles[i - 1];
+        // indices of displayed styles might be reused, so invalidate them all.
+        entry->displayed = TERMPAINTP_STYLE_NONE;
+        if (entry->state == TERMPAINTP_STYLE_MARKED) {
+            entry->state = TERMPAINTP_STYLE_USED;
+            table->count++;
+        } else {
+            if (entry->state == TERMPAINTP_STYLE_USED) {
+                termpaintp_surface_patch_unref(surface, entry->patch_idx);
+                entry->patch_idx = 0;
             }
-            continue;
+            entry->state = TERMPAINTP_STYLE_FREE;
+            entry->next = table->free_list;
+            table->free_list = i - 1;
         }
+    }
+    termpaintp_style_table_rebuild_buckets(table);
+    table->gc_active = false;
+    table->gc_trigger = table->count * 2;
+}
 
-        if (surface->patches[i].setup_hash == setup_hash
-                && surface->patches[i].cleanup_hash == cleanup_hash
-                && ustrcmp(setup, surface->patches[i].setup) == 0
-                && ustrcmp(cleanup, surface->patches[i].cleanup) == 0) {
-            return i + 1;
+// Garbage collection of styles is spread over the calls that add new styles, so no call has to scan the whole
+// surface. Like for overflow text a collection starts when the table holds enough styles and each new style then
+// marks the next part of the cells, sized so that the collection finishes before the table could hold 1.5 times the
+// trigger size. Styles returned by termpaintp_surface_intern_style while the collection is active are marked
+// directly. Cells are not moved to a different index except for scrolling in flush, which marks the moved cells
+// itself. With finish the whole remaining surface is marked, this is only used when the table can not grow.
+static void termpaintp_surface_style_gc_step(termpaint_surface *surface, bool finish) {
+    termpaintp_style_table *table = &surface->styles;
+    if (table->gc_blocked) {
+        return;
+    }
+    if (!table->gc_active) {
+        if (table->gc_trigger < TERMPAINTP_STYLE_GC_MIN_TRIGGER) {
+            table->gc_trigger = TERMPAINTP_STYLE_GC_MIN_TRIGGER;
+        }
+        if (table->count < table->gc_trigger && !finish) {
+            return;
         }
+        table->gc_active = true;
+        table->gc_pos = 0;
     }
 
-    if (free_slot == -1) {
-        // try to free unused entries
-        for (int i = 0; i < 255; ++i) {
-            surface->patches[i].unused = true;
+    const unsigned cell_count = surface->width * surface->height;
+    const unsigned budget = finish ? cell_count : cell_count / (table->gc_trigger / 2) + 1;
+    unsigned end = table->gc_pos + budget;
+    if (end > cell_count) {
+        end = cell_count;
+    }
+    for (unsigned i = table->gc_pos; i < end; i++) {
+        table->styles[surface->cells[i].style].state = TERMPAINTP_STYLE_MARKED;
+        if (surface->cells_last_flush) {
+            table->styles[surface->cells_last_flush[i].style].state = TERMPAINTP_STYLE_MARKED;
         }
+    }
+    table->gc_pos = end;
 
-        for (int y = 0; y < surface->height; y++) {
-            for (int x = 0; x < surface->width; x++) {
-                cell* c = termpaintp_getcell(surface, x, y);
-                if (c->attr_patch_idx) {
-                    surface->patches[c->attr_patch_idx - 1].unused = false;
-                }
-                if (surface->cells_last_flush) {
-                    cell* old_c = &surface->cells_last_flush[y*surface->width+x];
-                    if (old_c->attr_patch_idx) {
-                        surface->patches[old_c->attr_patch_idx - 1].unused = false;
-                    }
-                }
-            }
-        }
+    if (end == cell_count) {
+        termpaintp_surface_style_gc_sweep(surface);
+    }
+}
 
-        for (int i = 0; i < 255; ++i) {
-            if (surface->patches[i].unused) {
-                free(surface->patches[i].setup);
-                free(surface->patches[i].cleanup);
-                surface->patches[i].setup = nullptr;
-                surface->patches[i].cleanup = nullptr;
+// Returns the index of the style with the given attributes, adding it to the style table if needed.
+// Adding a style can expire unused styles, so indices not stored in a cell of the surface are invalid afterwards
+// unless gc_blocked is set.
+static uint32_t termpaintp_surface_intern_style(termpaint_surface *surface, uint32_t fg, uint32_t bg, uint32_t deco,
+                                                uint16_t flags, uint32_t patch_idx) {
+    termpaintp_style_table *table = &surface->styles;
+    if (!table->allocated) {
+        // collapsed surface, there are no cells that could use the style.
+        return 0;
+    }
 
-                if (free_slot == -1) {
-                    free_slot = i;
-                }
-            }
+    const uint32_t hash = termpaintp_style_hash(fg, bg, deco, flags, patch_idx);
+
+    uint32_t idx = table->buckets[hash & (table->allocated - 1)];
+    while (idx != TERMPAINTP_STYLE_NONE) {
+        termpaintp_style *entry = &table->styles[idx];
+        if (entry->fg_color == fg && entry->bg_color == bg && entry->deco_color == deco
+                && entry->flags == flags && entry->patch_idx == patch_idx) {
+            termpaintp_style_table_gc_mark(table, idx);
+            return idx;
         }
+        idx = entry->next;
     }
 
-    if (free_slot != -1) {
-        unsigned char *setup_copy = ustrdup(setup);
-        unsigned char *cleanup_copy = ustrdup(cleanup);
-        if (!setup_copy || !cleanup_copy) {
+    // before allocating, so that the new style is marked if this starts a collection
+    termpaintp_surface_style_gc_step(surface, false);
+
+    if (table->free_list == TERMPAINTP_STYLE_NONE && table->used == table->allocated) {
+        if (!termpaintp_style_table_grow_mustcheck(table)) {
             if (!surface->terminal->glitch_on_oom) {
                 termpaintp_oom(surface->terminal);
             } else {
-                free(setup_copy);
-                free(cleanup_copy);
                 termpaintp_oom_log_only(surface->terminal);
-                return 0;
+                termpaintp_surface_style_gc_step(surface, true);
+                if (table->free_list == TERMPAINTP_STYLE_NONE) {
+                    return 0;
+                }
             }
         }
-        surface->patches[free_slot].optimize = optimize;
-        surface->patches[free_slot].setup_hash = setup_hash;
-        surface->patches[free_slot].cleanup_hash = cleanup_hash;
-        surface->patches[free_slot].setup = setup_copy;
-        surface->patches[free_slot].cleanup = cleanup_copy;
+    }
 
-        return free_slot + 1;
+    if (table->free_list != TERMPAINTP_STYLE_NONE) {
+        idx = table->free_list;
+        table->free_list = table->styles[idx].next;
+    } else {
+        idx = table->used++;
     }
+    table->count++;
 
-    // can't fit anymore, just ignore it.
-    return 0;
+    termpaintp_style *entry = &table->styles[idx];
+    entry->fg_color = fg;
+    entry->bg_color = bg;
+    entry->deco_color = deco;
+    entry->flags = flags;
+    entry->patch_idx = patch_idx;
+    termpaintp_surface_patch_ref(surface, patch_idx);
+    entry->state = table->gc_active ? TERMPAINTP_STYLE_MARKED : TERMPAINTP_STYLE_USED;
+    entry->displayed = TERMPAINTP_STYLE_NONE;
+    uint32_t bucket = hash & (table->allocated - 1);
+    entry->next = table->buckets[bucket];
+    table->buckets[bucket] = idx;
+    return idx;
 }
 
 void termpaint_surface_write_with_colors(termpaint_surface *surface, int x, int y, const char *string, int fg, int bg) {
@@ -940,13 +1408,18 @@ static void termpaintp_surface_vanish_char(termpaint_surface *surface, int x, in
     }
 }
 
-static void termpaintp_surface_attr_apply(termpaint_surface *surface, cell *cell, termpaint_attr const *attr) {
-    cell->fg_color = attr->fg_color;
-    cell->bg_color = attr->bg_color;
-    cell->deco_color = attr->deco_color;
-    cell->flags = attr->flags;
-    cell->attr_patch_idx = termpaintp_surface_ensure_patch_idx(surface, attr->patch_optimize,
-                                                               attr->patch_setup, attr->patch_cleanup);
+static uint32_t termpaintp_surface_intern_attr(termpaint_surface *surface, termpaint_attr const *attr) {
+    uint32_t patch_idx = termpaintp_surface_ensure_patch_idx(surface, attr->patch_optimize,
+                                                             attr->patch_setup, attr->patch_cleanup);
+    uint32_t style = termpaintp_surface_intern_style(surface, attr->fg_color, attr->bg_color, attr->deco_color,
+                                                     attr->flags, patch_idx);
+    termpaintp_surface_patch_unref(surface, patch_idx);
+    return style;
+}
+
+static inline void termpaintp_surface_attr_apply(cell *cell, uint32_t style) {
+    cell->style = style;
+    cell->flags = 0;
 }
 
 void termpaint_surface_write_with_attr_clipped(termpaint_surface *surface, int x, int y, const char *string_s, termpaint_attr const *attr, int clip_x0, int clip_x1) {
@@ -957,7 +1430,9 @@ void termpaint_surface_write_with_attr_clipped(termpaint_surface *surface, int x
 void termpaint_surface_write_with_len_attr_clipped(termpaint_surface *surface, int x, int y, const char *string_s, int len, termpaint_attr const *attr, int clip_x0, int clip_x1) {
     const termpaintp_width *char_width_table = surface->terminal->char_width_table;
     const unsigned char *string = (const unsigned char *)string_s;
-    if (y < 0) return;
+    if (y < 0 || y >= surface->height) return;
+    termpaintp_surface_mark_rows_dirty(surface, y, y);
+    const uint32_t style = termpaintp_surface_intern_attr(surface, attr);
     if (clip_x0 < 0) clip_x0 = 0;
     if (clip_x1 >= surface->width) {
         clip_x1 = surface->width-1;
@@ -1030,7 +1505,7 @@ void termpaint_surface_write_with_len_attr_clipped(termpaint_surface *surface, i
 
             termpaintp_surface_vanish_char(surface, x + 1, y, cluster_width - 1);
 
-            termpaintp_surface_attr_apply(surface, c, attr);
+            termpaintp_surface_attr_apply(c, style);
 
             c->text[0] = ' ';
             c->text_len = 1;
@@ -1041,7 +1516,7 @@ void termpaint_surface_write_with_len_attr_clipped(termpaint_surface *surface, i
 
             termpaintp_surface_vanish_char(surface, x, y, cluster_width - 1);
 
-            termpaintp_surface_attr_apply(surface, c, attr);
+            termpaintp_surface_attr_apply(c, style);
 
             c->text[0] = ' ';
             c->text_len = 1;
@@ -1050,7 +1525,7 @@ void termpaint_surface_write_with_len_attr_clipped(termpaint_surface *surface, i
 
             termpaintp_surface_vanish_char(surface, x, y, cluster_width);
 
-            termpaintp_surface_attr_apply(surface, c, attr);
+            termpaintp_surface_attr_apply(c, style);
 
             c->cluster_expansion = cluster_width - 1;
             if (output_bytes_used <= 8) {
@@ -1067,7 +1542,7 @@ void termpaint_surface_write_with_len_attr_clipped(termpaint_surface *surface, i
             }
             for (int i = 1; i < cluster_width; i++) {
                 cell *c = termpaintp_getcell(surface, x + i, y);
-                termpaintp_surface_attr_apply(surface, c, attr);
+                termpaintp_surface_attr_apply(c, style);
                 c->cluster_expansion = 0;
                 c->text_len = 0;
                 c->text_overflow = WIDE_RIGHT_PADDING;
@@ -1112,6 +1587,9 @@ static void termpaintp_surface_clear_rect_with_attr_and_string(termpaint_surface
     if (y >= surface->height) return;
     if (x+width > surface->width) width = surface->width - x;
     if (y+height > surface->height) height = surface->height - y;
+    termpaintp_surface_mark_rows_dirty(surface, y, y + height - 1);
+    const uint32_t style = termpaintp_surface_intern_style(surface, attr->fg_color, attr->bg_color,
+                                                           TERMPAINT_DEFAULT_COLOR, attr->flags, 0);
     for (int y1 = y; y1 < y + height; y1++) {
         termpaintp_surface_vanish_char(surface, x, y1, 1);
         termpaintp_surface_vanish_char(surface, x + width - 1, y1, 1);
@@ -1125,13 +1603,14 @@ static void termpaintp_surface_clear_rect_with_attr_and_string(termpaint_surface
                 c->text_len = 0;
                 c->text_overflow = nullptr;
             }
-            c->bg_color = attr->bg_color;
-            c->fg_color = attr->fg_color;
-            c->deco_color = TERMPAINT_DEFAULT_COLOR;
-            c->flags = attr->flags;
-            c->attr_patch_idx = 0;
+            termpaintp_surface_attr_apply(c, style);
         }
     }
+    if (x == 0 && y == 0 && width == surface->width && height == surface->height && !surface->cells_last_flush) {
+        // the whole surface was cleared, release all overflow text at once
+        termpaintp_hash_clear(&surface->overflow_text);
+        termpaintp_surface_overflow_gc_reset(surface);
+    }
 }
 
 void termpaint_surface_clear_rect_with_attr(termpaint_surface *surface, int x, int y,
@@ -1181,31 +1660,33 @@ void termpaint_surface_clear_rect_with_char(termpaint_surface *surface, int x, i
     }
 }
 
-void termpaint_surface_set_fg_color(const termpaint_surface *surface, int x, int y, unsigned fg) {
-    if (x < 0) return;
-    if (y < 0) return;
-    if (x >= surface->width) return;
-    if (y >= surface->height) return;
-    cell* c = termpaintp_getcell(surface, x, y);
-
-    if (c->text_len == 0 && c->text_overflow == WIDE_RIGHT_PADDING) {
-        // only the first cell of a multi cell character can be used to change it.
-        // This prevents duplicate changes with naive adjust each cell code.
-        return;
-    }
+#define TERMPAINTP_SET_FG 0
+#define TERMPAINTP_SET_BG 1
+#define TERMPAINTP_SET_DECO 2
 
-    c->fg_color = fg;
-    for (int i = 0; i < c->cluster_expansion; i++) {
-        cell* exp_cell = termpaintp_getcell(surface, x + 1 + i, y);
-        exp_cell->fg_color = fg;
+static uint32_t termpaintp_surface_style_with_color(termpaint_surface *surface, uint32_t style, int which,
+                                                   unsigned color) {
+    termpaintp_style entry = *termpaintp_surface_style(surface, style);
+    if (which == TERMPAINTP_SET_FG) {
+        entry.fg_color = color;
+    } else if (which == TERMPAINTP_SET_BG) {
+        entry.bg_color = color;
+    } else {
+        entry.deco_color = color;
     }
+    return termpaintp_surface_intern_style(surface, entry.fg_color, entry.bg_color, entry.deco_color,
+                                           entry.flags, entry.patch_idx);
 }
 
-void termpaint_surface_set_bg_color(const termpaint_surface *surface, int x, int y, unsigned bg) {
+static void termpaintp_surface_set_color(const termpaint_surface *surface_const, int x, int y, int which,
+                                         unsigned color) {
+    // The style table is not part of the observable state of the surface.
+    termpaint_surface *surface = (termpaint_surface*)surface_const;
     if (x < 0) return;
     if (y < 0) return;
     if (x >= surface->width) return;
     if (y >= surface->height) return;
+    termpaintp_surface_mark_rows_dirty(surface, y, y);
     cell* c = termpaintp_getcell(surface, x, y);
 
     if (c->text_len == 0 && c->text_overflow == WIDE_RIGHT_PADDING) {
@@ -1214,31 +1695,28 @@ void termpaint_surface_set_bg_color(const termpaint_surface *surface, int x, int
         return;
     }
 
-    c->bg_color = bg;
+    const uint32_t old_style = c->style;
+    c->style = termpaintp_surface_style_with_color(surface, old_style, which, color);
     for (int i = 0; i < c->cluster_expansion; i++) {
         cell* exp_cell = termpaintp_getcell(surface, x + 1 + i, y);
-        exp_cell->bg_color = bg;
+        if (exp_cell->style == old_style) {
+            exp_cell->style = c->style;
+        } else {
+            exp_cell->style = termpaintp_surface_style_with_color(surface, exp_cell->style, which, color);
+        }
     }
 }
 
-void termpaint_surface_set_deco_color(const termpaint_surface *surface, int x, int y, unsigned deco_color) {
-    if (x < 0) return;
-    if (y < 0) return;
-    if (x >= surface->width) return;
-    if (y >= surface->height) return;
-    cell* c = termpaintp_getcell(surface, x, y);
+void termpaint_surface_set_fg_color(const termpaint_surface *surface, int x, int y, unsigned fg) {
+    termpaintp_surface_set_color(surface, x, y, TERMPAINTP_SET_FG, fg);
+}
 
-    if (c->text_len == 0 && c->text_overflow == WIDE_RIGHT_PADDING) {
-        // only the first cell of a multi cell character can be used to change it.
-        // This prevents duplicate changes with naive adjust each cell code.
-        return;
-    }
+void termpaint_surface_set_bg_color(const termpaint_surface *surface, int x, int y, unsigned bg) {
+    termpaintp_surface_set_color(surface, x, y, TERMPAINTP_SET_BG, bg);
+}
 
-    c->deco_color = deco_color;
-    for (int i = 0; i < c->cluster_expansion; i++) {
-        cell* exp_cell = termpaintp_getcell(surface, x + 1 + i, y);
-        exp_cell->deco_color = deco_color;
-    }
+void termpaint_surface_set_deco_color(const termpaint_surface *surface, int x, int y, unsigned deco_color) {
+    termpaintp_surface_set_color(surface, x, y, TERMPAINTP_SET_DECO, deco_color);
 }
 
 void termpaint_surface_set_softwrap_marker(termpaint_surface *surface, int x, int y, bool state) {
@@ -1246,6 +1724,7 @@ void termpaint_surface_set_softwrap_marker(termpaint_surface *surface, int x, in
     if (y < 0) return;
     if (x >= surface->width) return;
     if (y >= surface->height) return;
+    termpaintp_surface_mark_rows_dirty(surface, y, y);
     cell* c = termpaintp_getcell(surface, x, y);
 
     if (c->text_len == 0 && c->text_overflow == WIDE_RIGHT_PADDING) {
@@ -1264,6 +1743,7 @@ bool termpaint_surface_resize_mustcheck(termpaint_surface *surface, int width, i
     if (width < 0 || height < 0) {
         free(surface->cells);
         free(surface->cells_last_flush);
+        free(surface->dirty_rows);
         termpaintp_collapse(surface);
     } else {
         if (!termpaintp_resize_mustcheck(surface, width, height)) {
@@ -1287,28 +1767,9 @@ int termpaint_surface_height(const termpaint_surface *surface) {
     return surface->height;
 }
 
-static void termpaintp_surface_gc_mark_cb(termpaint_hash *hash) {
-    termpaint_surface *surface = container_of(hash, termpaint_surface, overflow_text);
-
-    for (int y = 0; y < surface->height; y++) {
-        for (int x = 0; x < surface->width; x++) {
-            cell* c = termpaintp_getcell(surface, x, y);
-            if (c->text_len == 0 && c->text_overflow != nullptr && c->text_overflow != WIDE_RIGHT_PADDING) {
-                c->text_overflow->unused = false;
-            }
-            if (surface->cells_last_flush) {
-                cell* old_c = &surface->cells_last_flush[y*surface->width+x];
-                if (old_c->text_len == 0 && old_c->text_overflow != nullptr && c->text_overflow != WIDE_RIGHT_PADDING) {
-                    old_c->text_overflow->unused = false;
-                }
-            }
-        }
-    }
-}
-
 static void termpaintp_surface_init(termpaint_surface *surface, termpaint_terminal *term) {
-    surface->overflow_text.gc_mark_cb = termpaintp_surface_gc_mark_cb;
     surface->overflow_text.item_size = sizeof(termpaint_hash_item);
+    surface->overflow_text.use_slab = true;
     surface->terminal = term;
 }
 
@@ -1358,40 +1819,48 @@ void termpaint_surface_free(termpaint_surface *surface) {
 
 static void termpaintp_copy_colors_and_attibutes(termpaint_surface *src_surface, cell *src_cell,
                                                  termpaint_surface *dst_surface, cell *dst_cell) {
-    dst_cell->fg_color = src_cell->fg_color;
-    dst_cell->bg_color = src_cell->bg_color;
-    dst_cell->deco_color = src_cell->deco_color;
-    dst_cell->flags = src_cell->flags;
-    if (src_cell->attr_patch_idx) {
-        termpaintp_patch* patch = &src_surface->patches[src_cell->attr_patch_idx - 1];
-        dst_cell->attr_patch_idx = termpaintp_surface_ensure_patch_idx(dst_surface,
-                                                                       patch->optimize,
-                                                                       patch->setup,
-                                                                       patch->cleanup);
+    const termpaintp_style src_style = *termpaintp_surface_style(src_surface, src_cell->style);
+    uint32_t patch_idx = termpaintp_surface_style(dst_surface, dst_cell->style)->patch_idx;
+    if (src_style.patch_idx) {
+        termpaintp_patch* patch = termpaintp_surface_patch(src_surface, src_style.patch_idx);
+        patch_idx = termpaintp_surface_ensure_patch_idx(dst_surface,
+                                                        patch->optimize,
+                                                        patch->setup,
+                                                        patch->cleanup);
+    } else {
+        // keep the patch alive, the style of dst_cell is not marked by a garbage collection during interning
+        termpaintp_surface_patch_ref(dst_surface, patch_idx);
     }
+    dst_cell->style = termpaintp_surface_intern_style(dst_surface, src_style.fg_color, src_style.bg_color,
+                                                      src_style.deco_color, src_style.flags, patch_idx);
+    termpaintp_surface_patch_unref(dst_surface, patch_idx);
+    dst_cell->flags = src_cell->flags;
 }
 
 void termpaint_surface_tint(termpaint_surface *surface,
                             void (*recolor)(void *user_data, unsigned *fg, unsigned *bg, unsigned *deco),
                             void *user_data) {
+    termpaintp_surface_mark_rows_dirty(surface, 0, surface->height - 1);
     for (int y = 0; y < surface->height; y++) {
         for (int x = 0; x < surface->width; x++) {
             cell *cell = termpaintp_getcell(surface, x, y);
+            const termpaintp_style style = *termpaintp_surface_style(surface, cell->style);
             // Don't give out pointers to internal cell structure contents.
-            unsigned fg = cell->fg_color;
-            unsigned bg = cell->bg_color;
-            unsigned deco = cell->deco_color;
+            unsigned fg = style.fg_color;
+            unsigned bg = style.bg_color;
+            unsigned deco = style.deco_color;
 
             recolor(user_data, &fg, &bg, &deco);
 
+            const uint32_t new_style = termpaintp_surface_intern_style(surface, fg, bg, deco,
+                                                                       style.flags, style.patch_idx);
+
             int expansion = cell->cluster_expansion;
 
             // update cluster at once, different colors in one cluster are not allowed
             for (int i = 0; i <= expansion; i++) {
                 cell = termpaintp_getcell(surface, x + i, y);
-                cell->fg_color = fg;
-                cell->bg_color = bg;
-                cell->deco_color = deco;
+                cell->style = new_style;
             }
             x += expansion;
         }
@@ -1465,6 +1934,8 @@ void termpaint_surface_copy_rect(termpaint_surface *src_surface, int x, int y, i
         return;
     }
 
+    termpaintp_surface_mark_rows_dirty(dst_surface, dst_y, dst_y + height - 1);
+
     for (int yOffset = 0; yOffset < height; yOffset++) {
         bool in_complete_cluster = false;
         int xOffset = 0;
@@ -1625,7 +2096,7 @@ unsigned termpaint_surface_peek_fg_color(const termpaint_surface *surface, int x
     if (!cell) {
         return 0;
     }
-    return cell->fg_color;
+    return termpaintp_surface_style(surface, cell->style)->fg_color;
 }
 
 unsigned termpaint_surface_peek_bg_color(const termpaint_surface *surface, int x, int y) {
@@ -1633,7 +2104,7 @@ unsigned termpaint_surface_peek_bg_color(const termpaint_surface *surface, int x
     if (!cell) {
         return 0;
     }
-    return cell->bg_color;
+    return termpaintp_surface_style(surface, cell->style)->bg_color;
 }
 
 unsigned termpaint_surface_peek_deco_color(const termpaint_surface *surface, int x, int y) {
@@ -1641,7 +2112,7 @@ unsigned termpaint_surface_peek_deco_color(const termpaint_surface *surface, int
     if (!cell) {
         return 0;
     }
-    return cell->deco_color;
+    return termpaintp_surface_style(surface, cell->style)->deco_color;
 }
 
 int termpaint_surface_peek_style(const termpaint_surface *surface, int x, int y) {
@@ -1649,7 +2120,7 @@ int termpaint_surface_peek_style(const termpaint_surface *surface, int x, int y)
     if (!cell) {
         return 0;
     }
-    unsigned flags = cell->flags;
+    unsigned flags = termpaintp_surface_style(surface, cell->style)->flags;
     int style = flags & TERMPAINT_STYLE_PASSTHROUGH;
     if ((flags & CELL_ATTR_UNDERLINE_MASK) == CELL_ATTR_UNDERLINE_SINGLE) {
         style |= TERMPAINT_STYLE_UNDERLINE;
@@ -1663,13 +2134,14 @@ int termpaint_surface_peek_style(const termpaint_surface *surface, int x, int y)
 
 void termpaint_surface_peek_patch(const termpaint_surface *surface, int x, int y, const char **setup, const char **cleanup, bool *optimize) {
     cell *cell = termpaintp_getcell_or_null(surface, x, y);
-    if (!cell || !cell->attr_patch_idx) {
+    const uint32_t patch_idx = cell ? termpaintp_surface_style(surface, cell->style)->patch_idx : 0;
+    if (!patch_idx) {
         *setup = nullptr;
         *cleanup = nullptr;
         *optimize = true;
         return;
     }
-    termpaintp_patch* patch = &surface->patches[cell->attr_patch_idx - 1];
+    termpaintp_patch* patch = termpaintp_surface_patch(surface, patch_idx);
     *setup = (const char *)patch->setup;
     *cleanup = (const char *)patch->cleanup;
     *optimize = patch->optimize;
@@ -1799,16 +2271,93 @@ int termpaint_surface_char_width(const termpaint_surface *surface, int codepoint
     return termpaintp_char_width(char_width_table, codepoint);
 }
 
-static void int_puts(termpaint_integration *integration, const char *str) {
-    integration->p->write(integration, str, strlen(str));
+static void int_write_unbuffered(termpaint_terminal *term, const char *str, int len) {
+    term->integration_vtbl->write(term->integration, str, len);
+}
+
+static void int_drain_output_buffer(termpaint_terminal *term) {
+    if (term->output_buffer.len) {
+        int_write_unbuffered(term, (const char*)term->output_buffer.data, (int)term->output_buffer.len);
+        term->output_buffer.len = 0;
+    }
+}
+
+// Append to the frame returned by termpaint_terminal_flush_to_buffer instead of passing it to the integration
+static void int_write_captured(termpaint_terminal *term, const char *str, int len) {
+    termpaint_str *captured = &term->captured_output;
+    if (captured->alloc < captured->len + (unsigned)len + 1) {
+        unsigned new_alloc = captured->alloc ? captured->alloc * 2 : 4096;
+        while (new_alloc < captured->len + (unsigned)len + 1) {
+            new_alloc *= 2;
+        }
+        unsigned char *new_data = realloc(captured->data, new_alloc);
+        if (!new_data) {
+            termpaintp_oom(term);
+        }
+        captured->data = new_data;
+        captured->alloc = new_alloc;
+    }
+    memcpy(captured->data + captured->len, str, (unsigned)len);
+    captured->len += (unsigned)len;
+    captured->data[captured->len] = 0;
+}
+
+static void int_write(termpaint_terminal *term, const char *str, int len) {
+    if (term->flush_stats_bytes && len > 0) {
+        *term->flush_stats_bytes += len;
+    }
+    if (term->capture_output) {
+        if (len > 0) {
+            int_write_captured(term, str, len);
+        }
+        return;
+    }
+    if (!term->output_buffering || len <= 0) {
+        int_write_unbuffered(term, str, len);
+        return;
+    }
+
+    termpaint_str *buffer = &term->output_buffer;
+    const unsigned limit = term->output_buffer_size;
+
+    if (buffer->len + (unsigned)len > limit) {
+        int_drain_output_buffer(term);
+        if ((unsigned)len > limit) {
+            int_write_unbuffered(term, str, len);
+            return;
+        }
+    }
+
+    if (buffer->alloc < buffer->len + (unsigned)len) {
+        // grow lazily, most frames are much smaller than the limit
+        unsigned new_alloc = buffer->alloc ? buffer->alloc * 2 : 4096;
+        while (new_alloc < buffer->len + (unsigned)len) {
+            new_alloc *= 2;
+        }
+        if (new_alloc > limit) {
+            new_alloc = limit;
+        }
+        unsigned char *new_data = realloc(buffer->data, new_alloc);
+        if (!new_data) {
+            // not fatal, just degrade to unbuffered output
+            int_drain_output_buffer(term);
+            int_write_unbuffered(term, str, len);
+            return;
+        }
+        buffer->data = new_data;
+        buffer->alloc = new_alloc;
+    }
+
+    memcpy(buffer->data + buffer->len, str, (unsigned)len);
+    buffer->len += (unsigned)len;
 }
 
-static void int_uputs(termpaint_integration *integration, const unsigned char *str) {
-    integration->p->write(integration, (const char*)str, ustrlen(str));
+static void int_puts(termpaint_terminal *term, const char *str) {
+    int_write(term, str, strlen(str));
 }
 
-static void int_write(termpaint_integration *integration, const char *str, int len) {
-    integration->p->write(integration, str, len);
+static void int_uputs(termpaint_terminal *term, const unsigned char *str) {
+    int_write(term, (const char*)str, ustrlen(str));
 }
 
 static void int_debuglog(termpaint_terminal *term, const char *str, int len) {
@@ -1833,19 +2382,19 @@ static void int_debuglog_printf(termpaint_terminal *term, const char *fmt, ...)
 }
 
 
-static void int_put_num(termpaint_integration *integration, int num) {
+static void int_put_num(termpaint_terminal *term, int num) {
     char buf[12];
     int len = sprintf(buf, "%d", num);
-    integration->p->write(integration, buf, len);
+    int_write(term, buf, len);
 }
 
-static void int_put_tps(termpaint_integration *integration, const termpaint_str *tps) {
-    integration->p->write(integration, (const char*)tps->data, (int)tps->len);
+static void int_put_tps(termpaint_terminal *term, const termpaint_str *tps) {
+    int_write(term, (const char*)tps->data, (int)tps->len);
 }
 
-static void int_awaiting_response(termpaint_integration *integration) {
-    if (integration->p->awaiting_response) {
-        integration->p->awaiting_response(integration);
+static void int_awaiting_response(termpaint_terminal *term) {
+    if (term->integration_vtbl->awaiting_response) {
+        term->integration_vtbl->awaiting_response(term->integration);
     }
 }
 
@@ -1856,27 +2405,33 @@ static void int_restore_sequence_updated(termpaint_terminal *term) {
     }
 }
 
-static void int_flush(termpaint_integration *integration) {
-    integration->p->flush(integration);
+// Collect all output into the output buffer until the next int_flush
+static void int_begin_buffering(termpaint_terminal *term) {
+    term->output_buffering = term->output_buffer_size > 0;
+}
+
+static void int_flush(termpaint_terminal *term) {
+    int_drain_output_buffer(term);
+    term->output_buffering = false;
+    if (!term->capture_output) {
+        term->integration_vtbl->flush(term->integration);
+    }
 }
 
 static void termpaintp_terminal_set_cursor(termpaint_terminal *term, int x, int y) {
-    termpaint_integration *integration = term->integration;
-    int_puts(integration, "\e[");
-    int_put_num(integration, y+1);
-    int_puts(integration, ";");
-    int_put_num(integration, x+1);
-    int_puts(integration, "H");
+    int_puts(term, "\e[");
+    int_put_num(term, y+1);
+    int_puts(term, ";");
+    int_put_num(term, x+1);
+    int_puts(term, "H");
 }
 
 static void termpaintp_terminal_hide_cursor(termpaint_terminal *term) {
-    termpaint_integration *integration = term->integration;
-    int_puts(integration, "\033[?25l");
+    int_puts(term, "\033[?25l");
 }
 
 static void termpaintp_terminal_show_cursor(termpaint_terminal *term) {
-    termpaint_integration *integration = term->integration;
-    int_puts(integration, "\033[?25h");
+    int_puts(term, "\033[?25h");
 }
 
 static void termpaintp_terminal_update_cursor_style(termpaint_terminal *term) {
@@ -1891,27 +2446,26 @@ static void termpaintp_terminal_update_cursor_style(termpaint_terminal *term) {
             cmd = TERMPAINT_CURSOR_STYLE_BLOCK + (term->cursor_blink ? 0 : 1);
         }
         if (cmd != term->cursor_prev_data) {
-            termpaint_integration *integration = term->integration;
             if (termpaint_terminal_capable(term, TERMPAINT_CAPABILITY_CURSOR_SHAPE_OSC50)) {
                 // e.g. konsole. (konsole starting at version 18.07.70 could do the CSI space q one too, but
                 // we don't have the konsole version.)
                 if (term->cursor_style == TERMPAINT_CURSOR_STYLE_BAR) {
-                    int_puts(integration, "\x1b]50;CursorShape=1;BlinkingCursorEnabled=");
+                    int_puts(term, "\x1b]50;CursorShape=1;BlinkingCursorEnabled=");
                 } else if (term->cursor_style == TERMPAINT_CURSOR_STYLE_UNDERLINE) {
-                    int_puts(integration, "\x1b]50;CursorShape=2;BlinkingCursorEnabled=");
+                    int_puts(term, "\x1b]50;CursorShape=2;BlinkingCursorEnabled=");
                 } else {
-                    int_puts(integration, "\x1b]50;CursorShape=0;BlinkingCursorEnabled=");
+                    int_puts(term, "\x1b]50;CursorShape=0;BlinkingCursorEnabled=");
                 }
                 if (term->cursor_blink) {
-                    int_puts(integration, "1\a");
+                    int_puts(term, "1\a");
                 } else {
-                    int_puts(integration, "0\a");
+                    int_puts(term, "0\a");
                 }
                 resetSequence = "\x1b]50;CursorShape=0;BlinkingCursorEnabled=0\a";
             } else {
-                int_puts(integration, "\033[");
-                int_put_num(integration, cmd);
-                int_puts(integration, " q");
+                int_puts(term, "\033[");
+                int_put_num(term, cmd);
+                int_puts(term, " q");
             }
         }
         if (term->cursor_prev_data == -1) {
@@ -1966,6 +2520,7 @@ termpaint_terminal *termpaint_terminal_new_or_nullptr(termpaint_integration *int
     ret->terminal_type = TT_UNKNOWN;
     ret->terminal_type_confidence = 0;
     ret->max_csi_parameters = 15;
+    ret->output_buffer_size = TERMPAINTP_DEFAULT_OUTPUT_BUFFER_SIZE;
     ret->input = termpaint_input_new();
     if (!ret->input) {
         free(ret);
@@ -2032,6 +2587,15 @@ void termpaint_terminal_glitch_on_out_of_memory(termpaint_terminal *term) {
     term->glitch_on_oom = true;
 }
 
+void termpaint_terminal_set_output_buffer_size(termpaint_terminal *term, int size) {
+    if (size < 0) {
+        size = 0;
+    }
+    int_drain_output_buffer(term);
+    termpaintp_str_destroy(&term->output_buffer);
+    term->output_buffer_size = (unsigned)size;
+}
+
 void termpaint_terminal_free(termpaint_terminal *term) {
     if (!term) {
         return;
@@ -2041,6 +2605,10 @@ void termpaint_terminal_free(termpaint_terminal *term) {
     termpaintp_str_destroy(&term->terminal_self_reported_name_version);
     termpaintp_surface_destroy(&term->primary);
     termpaintp_str_destroy(&term->restore_seq);
+    termpaintp_str_destroy(&term->output_buffer);
+    termpaintp_str_destroy(&term->captured_output);
+    free(term->sgr_cache);
+    free(term->quantize_cache);
     termpaint_input_free(term->input);
     term->input = nullptr;
     term->integration_vtbl->free(term->integration);
@@ -2057,16 +2625,15 @@ void termpaint_terminal_free_with_restore(termpaint_terminal *term) {
         return;
     }
 
-    termpaint_integration *integration = term->integration;
 
     if (term->primary.height && term->primary.height) {
         termpaintp_terminal_set_cursor(term, 0, term->primary.height - 1);
     }
 
     if (term->restore_seq.len) {
-        int_write(integration, (const char*)term->restore_seq.data, term->restore_seq.len);
+        int_write(term, (const char*)term->restore_seq.data, term->restore_seq.len);
     }
-    int_flush(integration);
+    int_flush(term);
 
     termpaint_terminal_free(term);
 }
@@ -2115,10 +2682,29 @@ static char* termpaintp_terminal_correct_string_terminator(const termpaint_termi
     }
 }
 
+static void termpaintp_terminal_invalidate_sgr_cache(termpaint_terminal *term) {
+    free(term->sgr_cache);
+    term->sgr_cache = nullptr;
+}
+
 static void termpaintp_update_cache_from_capabilities(termpaint_terminal *terminal) {
     terminal->cache_should_use_truecolor =
-            termpaint_terminal_capable(terminal, TERMPAINT_CAPABILITY_TRUECOLOR_MAYBE_SUPPORTED)
-            || termpaint_terminal_capable(terminal, TERMPAINT_CAPABILITY_TRUECOLOR_SUPPORTED);
+            (termpaint_terminal_capable(terminal, TERMPAINT_CAPABILITY_TRUECOLOR_MAYBE_SUPPORTED)
+             || termpaint_terminal_capable(terminal, TERMPAINT_CAPABILITY_TRUECOLOR_SUPPORTED))
+            && !terminal->low_bandwidth;
+    // color quantization in flush depends on the capabilities
+    termpaintp_surface_mark_rows_dirty(&terminal->primary, 0, terminal->primary.height - 1);
+    if (terminal->double_buffered) {
+        // cells_last_flush has unquantized colors, the colors that were actually sent are not known anymore.
+        terminal->force_full_repaint = true;
+    }
+    termpaintp_terminal_invalidate_sgr_cache(terminal);
+    free(terminal->quantize_cache);
+    terminal->quantize_cache = nullptr;
+    termpaintp_style_table *styles = &terminal->primary.styles;
+    for (uint32_t i = 0; i < styles->used; i++) {
+        styles->styles[i].displayed = TERMPAINTP_STYLE_NONE;
+    }
 }
 
 void termpaint_terminal_promise_capability(termpaint_terminal *terminal, int capability) {
@@ -2229,119 +2815,818 @@ static uint32_t termpaintp_quantize_color(termpaint_terminal *term, uint32_t col
                 const int green_quantized = termpaintp_grid6_values[green_index];
                 const int blue_quantized = termpaintp_grid6_values[blue_index];
 
-#define SQ(x) ((x) * (x))
-                if ((SQ(grey_quantized - r) + SQ(grey_quantized - g) + SQ(grey_quantized - b))
-                        < (SQ(red_quantized - r) + SQ(green_quantized - g) + SQ(blue_quantized - b))) {
-#undef SQ
-                    color = TERMPAINT_INDEXED_COLOR + 232 + grey_index;
-                } else {
-                    color = TERMPAINT_INDEXED_COLOR + 16
-                            + red_index * 36
-                            + green_index * 6
-                            + blue_index;
-                }
+#define SQ(x) ((x) * (x))
+                if ((SQ(grey_quantized - r) + SQ(grey_quantized - g) + SQ(grey_quantized - b))
+                        < (SQ(red_quantized - r) + SQ(green_quantized - g) + SQ(blue_quantized - b))) {
+#undef SQ
+                    color = TERMPAINT_INDEXED_COLOR + 232 + grey_index;
+                } else {
+                    color = TERMPAINT_INDEXED_COLOR + 16
+                            + red_index * 36
+                            + green_index * 6
+                            + blue_index;
+                }
+            }
+        }
+    }
+    return color;
+}
+
+// Memoized version of termpaintp_quantize_color. Flush quantizes every cell it compares, usually with only a few
+// distinct colors on screen.
+static inline uint32_t termpaintp_quantize_color_cached(termpaint_terminal *term, uint32_t color) {
+    if (term->cache_should_use_truecolor || (color & 0xff000000) != TERMPAINT_RGB_COLOR_OFFSET) {
+        return color;
+    }
+    if (!term->quantize_cache) {
+        term->quantize_cache = calloc(1 << TERMPAINTP_QUANTIZE_CACHE_BITS, sizeof(termpaintp_quantize_cache_entry));
+        if (!term->quantize_cache) {
+            return termpaintp_quantize_color(term, color);
+        }
+    }
+    const uint32_t slot = ((color & 0xffffff) * 2654435761u) >> (32 - TERMPAINTP_QUANTIZE_CACHE_BITS);
+    termpaintp_quantize_cache_entry *entry = &term->quantize_cache[slot];
+    if (entry->color != color) {
+        entry->color = color;
+        entry->quantized = termpaintp_quantize_color(term, color);
+    }
+    return entry->quantized;
+}
+
+// Returns the style the terminal displays for a style of the primary surface. That is with colors quantized
+// to what the terminal supports. The decoration color is only displayed with underline, without it is kept as is.
+static uint32_t termpaintp_terminal_displayed_style(termpaint_terminal *term, uint32_t style) {
+    termpaint_surface *primary = &term->primary;
+    const uint32_t memo = termpaintp_surface_style(primary, style)->displayed;
+    if (memo != TERMPAINTP_STYLE_NONE) {
+        termpaintp_style_table_gc_mark(&primary->styles, memo);
+        return memo;
+    }
+    const termpaintp_style entry = *termpaintp_surface_style(primary, style);
+    uint32_t deco = entry.deco_color;
+    if (entry.flags & CELL_ATTR_DECO_MASK && term->low_bandwidth) {
+        deco = TERMPAINT_DEFAULT_COLOR;
+    }
+    const uint32_t displayed = termpaintp_surface_intern_style(primary,
+                                                               termpaintp_quantize_color_cached(term, entry.fg_color),
+                                                               termpaintp_quantize_color_cached(term, entry.bg_color),
+                                                               deco, entry.flags, entry.patch_idx);
+    // interning can move the style table
+    termpaintp_surface_style(primary, style)->displayed = displayed;
+    return displayed;
+}
+
+// SGR sequences are assembled here first, so that flush can pick the shorter encoding.
+typedef struct {
+    int index;
+    int max;
+    int len;
+    char buffer[256];
+} termpaintp_sgr_params;
+
+static void termpaintp_sgr_puts(termpaintp_sgr_params *params, const char *str) {
+    int len = strlen(str);
+    if (params->len + len > (int)sizeof(params->buffer)) {
+        // can not happen with sane max_csi_parameters, buffer has room for all parameters
+        return;
+    }
+    memcpy(params->buffer + params->len, str, len);
+    params->len += len;
+}
+
+static void termpaintp_sgr_put_num(termpaintp_sgr_params *params, int num) {
+    char buf[12];
+    sprintf(buf, "%d", num);
+    termpaintp_sgr_puts(params, buf);
+}
+
+static void termpaintp_sgr_put_param(termpaintp_sgr_params *params, const char *str, int count) {
+    if (params->index + count >= params->max) {
+        termpaintp_sgr_puts(params, "m\033[");
+        termpaintp_sgr_puts(params, str + 1); // skip first ";"
+        params->index = count;
+    } else {
+        termpaintp_sgr_puts(params, str);
+        params->index += count;
+    }
+}
+
+static inline void write_color_sgr_values(termpaintp_sgr_params *params, uint32_t color, char *direct, char *indexed, char *sep, unsigned named, unsigned bright_named) {
+    if ((color & 0xff000000) == TERMPAINT_RGB_COLOR_OFFSET) {
+        if (params->index + 5 >= params->max) {
+            termpaintp_sgr_puts(params, "m\033[");
+            params->index = 0;
+            termpaintp_sgr_puts(params, direct + 1); // skip first ";"
+        } else {
+            termpaintp_sgr_puts(params, direct);
+        }
+        termpaintp_sgr_put_num(params, (color >> 16) & 0xff);
+        termpaintp_sgr_puts(params, sep);
+        termpaintp_sgr_put_num(params, (color >> 8) & 0xff);
+        termpaintp_sgr_puts(params, sep);
+        termpaintp_sgr_put_num(params, (color) & 0xff);
+        params->index += 5;
+    } else if (TERMPAINT_INDEXED_COLOR <= color && TERMPAINT_INDEXED_COLOR + 255 >= color) {
+        if (params->index + 3 >= params->max) {
+            termpaintp_sgr_puts(params, "m\033[");
+            params->index = 0;
+            termpaintp_sgr_puts(params, indexed + 1); // skip first ";"
+        } else {
+            termpaintp_sgr_puts(params, indexed);
+        }
+        termpaintp_sgr_put_num(params, (color) & 0xff);
+        params->index += 3;
+    } else {
+        if (named) {
+            if (TERMPAINT_NAMED_COLOR <= color && TERMPAINT_NAMED_COLOR + 7 >= color) {
+                if (params->index + 1 >= params->max) {
+                    termpaintp_sgr_puts(params, "m\033[");
+                    params->index = 0;
+                } else {
+                    termpaintp_sgr_puts(params, ";");
+                }
+                termpaintp_sgr_put_num(params, named + (color - TERMPAINT_NAMED_COLOR));
+                params->index += 1;
+            } else if (TERMPAINT_NAMED_COLOR + 8 <= color && TERMPAINT_NAMED_COLOR + 15 >= color) {
+                if (params->index + 1 >= params->max) {
+                    termpaintp_sgr_puts(params, "m\033[");
+                    params->index = 0;
+                } else {
+                    termpaintp_sgr_puts(params, ";");
+                }
+                termpaintp_sgr_put_num(params, bright_named + (color - (TERMPAINT_NAMED_COLOR + 8)));
+                params->index += 1;
+            }
+        } else {
+            if (TERMPAINT_NAMED_COLOR <= color && TERMPAINT_NAMED_COLOR + 15 >= color) {
+                if (params->index + 3 >= params->max) {
+                    termpaintp_sgr_puts(params, "m\033[");
+                    params->index = 0;
+                    termpaintp_sgr_puts(params, indexed + 1); // skip first ";"
+                } else {
+                    termpaintp_sgr_puts(params, indexed);
+                }
+                termpaintp_sgr_put_num(params, (color - TERMPAINT_NAMED_COLOR));
+                params->index += 3;
+            }
+        }
+    }
+}
+
+static void termpaintp_sgr_put_underline(termpaintp_sgr_params *params, uint32_t underline) {
+    if (underline == CELL_ATTR_UNDERLINE_SINGLE) {
+        termpaintp_sgr_put_param(params, ";4", 1);
+    } else if (underline == CELL_ATTR_UNDERLINE_DOUBLE) {
+        termpaintp_sgr_put_param(params, ";21", 1);
+    } else if (underline == CELL_ATTR_UNDERLINE_CURLY) {
+        // TODO maybe filter this by terminal capability somewhere?
+        termpaintp_sgr_put_param(params, ";4:3", 2);
+    }
+}
+
+// Reset all attributes and then set the wanted attributes.
+static void termpaintp_sgr_full(termpaintp_sgr_params *params, uint32_t bg, uint32_t fg, uint32_t deco,
+                                uint32_t flags) {
+    termpaintp_sgr_puts(params, "\033[0");
+    params->index = 1;
+    write_color_sgr_values(params, bg, ";48;2;", ";48;5;", ";", 40, 100);
+    write_color_sgr_values(params, fg, ";38;2;", ";38;5;", ";", 30, 90);
+    write_color_sgr_values(params, deco, ";58:2:", ";58:5:", ":", 0, 0);
+    if (flags) {
+        if (flags & CELL_ATTR_BOLD) {
+            termpaintp_sgr_put_param(params, ";1", 1);
+        }
+        if (flags & CELL_ATTR_ITALIC) {
+            termpaintp_sgr_put_param(params, ";3", 1);
+        }
+        termpaintp_sgr_put_underline(params, flags & CELL_ATTR_UNDERLINE_MASK);
+        if (flags & CELL_ATTR_BLINK) {
+            termpaintp_sgr_put_param(params, ";5", 1);
+        }
+        if (flags & CELL_ATTR_OVERLINE) {
+            termpaintp_sgr_put_param(params, ";53", 1);
+        }
+        if (flags & CELL_ATTR_INVERSE) {
+            termpaintp_sgr_put_param(params, ";7", 1);
+        }
+        if (flags & CELL_ATTR_STRIKE) {
+            termpaintp_sgr_put_param(params, ";9", 1);
+        }
+    }
+    termpaintp_sgr_puts(params, "m");
+}
+
+static void termpaintp_sgr_delta_flag(termpaintp_sgr_params *params, uint32_t old_flags, uint32_t flags,
+                                      uint32_t flag, const char *on, const char *off) {
+    if ((old_flags ^ flags) & flag) {
+        termpaintp_sgr_put_param(params, (flags & flag) ? on : off, 1);
+    }
+}
+
+// Only change the attributes that differ from the currently active attributes.
+static void termpaintp_sgr_delta(termpaintp_sgr_params *params,
+                                 uint32_t old_bg, uint32_t old_fg, uint32_t old_deco, uint32_t old_flags,
+                                 uint32_t bg, uint32_t fg, uint32_t deco, uint32_t flags) {
+    termpaintp_sgr_puts(params, "\033[");
+    params->index = 0;
+    if (bg != old_bg) {
+        if (bg == TERMPAINT_DEFAULT_COLOR) {
+            termpaintp_sgr_put_param(params, ";49", 1);
+        } else {
+            write_color_sgr_values(params, bg, ";48;2;", ";48;5;", ";", 40, 100);
+        }
+    }
+    if (fg != old_fg) {
+        if (fg == TERMPAINT_DEFAULT_COLOR) {
+            termpaintp_sgr_put_param(params, ";39", 1);
+        } else {
+            write_color_sgr_values(params, fg, ";38;2;", ";38;5;", ";", 30, 90);
+        }
+    }
+    if (deco != old_deco) {
+        if (deco == TERMPAINT_DEFAULT_COLOR) {
+            termpaintp_sgr_put_param(params, ";59", 1);
+        } else {
+            write_color_sgr_values(params, deco, ";58:2:", ";58:5:", ":", 0, 0);
+        }
+    }
+    // 22 also resets faint, but termpaint never uses faint.
+    termpaintp_sgr_delta_flag(params, old_flags, flags, CELL_ATTR_BOLD, ";1", ";22");
+    termpaintp_sgr_delta_flag(params, old_flags, flags, CELL_ATTR_ITALIC, ";3", ";23");
+    if ((old_flags ^ flags) & CELL_ATTR_UNDERLINE_MASK) {
+        if (flags & CELL_ATTR_UNDERLINE_MASK) {
+            termpaintp_sgr_put_underline(params, flags & CELL_ATTR_UNDERLINE_MASK);
+        } else {
+            termpaintp_sgr_put_param(params, ";24", 1);
+        }
+    }
+    termpaintp_sgr_delta_flag(params, old_flags, flags, CELL_ATTR_BLINK, ";5", ";25");
+    termpaintp_sgr_delta_flag(params, old_flags, flags, CELL_ATTR_OVERLINE, ";53", ";55");
+    termpaintp_sgr_delta_flag(params, old_flags, flags, CELL_ATTR_INVERSE, ";7", ";27");
+    termpaintp_sgr_delta_flag(params, old_flags, flags, CELL_ATTR_STRIKE, ";9", ";29");
+    termpaintp_sgr_puts(params, "m");
+    if (params->buffer[2] == ';') {
+        // the first parameter does not need a separator
+        memmove(params->buffer + 2, params->buffer + 3, params->len - 3);
+        params->len -= 1;
+    }
+}
+
+// Switch the terminal from the old attributes to the new attributes. old_flags is -1 if the old attributes
+// are not known.
+static void termpaintp_terminal_write_sgr(termpaint_terminal *term,
+                                          uint32_t old_bg, uint32_t old_fg, uint32_t old_deco, uint32_t old_flags,
+                                          uint32_t bg, uint32_t fg, uint32_t deco, uint32_t flags) {
+    if (old_flags == (uint32_t)-1) {
+        old_bg = old_fg = old_deco = -1;
+    }
+    const uint32_t key[8] = { old_bg, old_fg, old_deco, old_flags, bg, fg, deco, flags };
+
+    uint32_t hash = 2166136261;
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ key[i]) * 16777619;
+    }
+    hash ^= hash >> 16;
+
+    if (!term->sgr_cache) {
+        term->sgr_cache = calloc(TERMPAINTP_SGR_CACHE_SIZE, sizeof(termpaintp_sgr_cache_entry));
+    }
+    termpaintp_sgr_cache_entry *entry = term->sgr_cache ? &term->sgr_cache[hash % TERMPAINTP_SGR_CACHE_SIZE]
+                                                        : nullptr;
+    if (entry && entry->len && memcmp(entry->key, key, sizeof(key)) == 0) {
+        int_write(term, entry->data, entry->len);
+        return;
+    }
+
+    termpaintp_sgr_params full;
+    full.len = 0;
+    full.max = term->max_csi_parameters;
+    termpaintp_sgr_full(&full, bg, fg, deco, flags);
+
+    termpaintp_sgr_params delta;
+    const termpaintp_sgr_params *best = &full;
+    if (old_flags != (uint32_t)-1) {
+        delta.len = 0;
+        delta.max = term->max_csi_parameters;
+        termpaintp_sgr_delta(&delta, old_bg, old_fg, old_deco, old_flags, bg, fg, deco, flags);
+        if (delta.len < full.len) {
+            best = &delta;
+        }
+    }
+
+    int_write(term, best->buffer, best->len);
+
+    if (entry && best->len <= TERMPAINTP_SGR_CACHE_MAX_LEN) {
+        memcpy(entry->key, key, sizeof(key));
+        memcpy(entry->data, best->buffer, best->len);
+        entry->len = best->len;
+    }
+}
+
+// Hash and weight of the visible contents of one row. Only used as a hint for scroll detection, the cell by cell
+// compare in flush still catches collisions.
+static uint32_t termpaintp_row_hash_step(uint32_t hash, uint32_t value) {
+    hash ^= value;
+    hash *= 16777619;
+    return hash;
+}
+
+static uint32_t termpaintp_row_hash(termpaint_terminal *term, cell *row, bool quantize, int *weight) {
+    uint32_t hash = 2166136261;
+    *weight = 1;
+    for (int x = 0; x < term->primary.width; x += 1 + row[x].cluster_expansion) {
+        const cell *c = &row[x];
+        if (c->text_len) {
+            for (int i = 0; i < c->text_len; i++) {
+                hash = termpaintp_row_hash_step(hash, c->text[i]);
+            }
+        } else {
+            hash = termpaintp_row_hash_step(hash, (uint32_t)(uintptr_t)c->text_overflow);
+        }
+        const termpaintp_style *style = termpaintp_surface_style(&term->primary,
+                quantize ? termpaintp_terminal_displayed_style(term, c->style) : c->style);
+        hash = termpaintp_row_hash_step(hash, style->fg_color);
+        hash = termpaintp_row_hash_step(hash, style->bg_color);
+        hash = termpaintp_row_hash_step(hash, style->flags | ((uint32_t)c->flags << 24));
+        hash = termpaintp_row_hash_step(hash, style->patch_idx);
+        if (style->flags & CELL_ATTR_DECO_MASK && !term->low_bandwidth) {
+            hash = termpaintp_row_hash_step(hash, style->deco_color);
+        }
+        if (c->text_len ? !(c->text_len == 1 && c->text[0] == ' ') : c->text_overflow != nullptr) {
+            *weight += 1;
+        }
+    }
+    return hash;
+}
+
+// Detect content that moved vertically since the last flush and let the terminal move it using scrolling margins
+// and insert/delete line. cells_last_flush is adjusted to match the terminal, so the normal compare in flush
+// only needs to paint the rows that got exposed.
+static void termpaintp_terminal_scroll_optimize(termpaint_terminal *term) {
+    const int width = term->primary.width;
+    const int height = term->primary.height;
+
+    if (width <= 0 || height < 2) {
+        return;
+    }
+
+    // Rows that are not dirty still match the terminal, so only the dirty range can have scrolled.
+    int top = 0;
+    while (top < height && !term->primary.dirty_rows[top]) {
+        top++;
+    }
+    int bottom = height - 1;
+    while (bottom > top && !term->primary.dirty_rows[bottom]) {
+        bottom--;
+    }
+    if (bottom <= top) {
+        return;
+    }
+
+    uint32_t *hashes = calloc(height * 2, sizeof(uint32_t));
+    int *weights = calloc(height * 2, sizeof(int));
+    if (!hashes || !weights) {
+        // this is only an optimization, just skip it.
+        free(hashes);
+        free(weights);
+        return;
+    }
+    uint32_t *new_hashes = hashes;
+    uint32_t *old_hashes = hashes + height;
+    int *new_weights = weights;
+    int *old_weights = weights + height;
+
+    for (int y = top; y <= bottom; y++) {
+        new_hashes[y] = termpaintp_row_hash(term, termpaintp_getcell(&term->primary, 0, y), true, &new_weights[y]);
+        old_hashes[y] = termpaintp_row_hash(term, &term->primary.cells_last_flush[y * width], term->double_buffered,
+                                            &old_weights[y]);
+    }
+
+    while (top < bottom && new_hashes[top] == old_hashes[top]) {
+        top++;
+    }
+    while (bottom > top && new_hashes[bottom] == old_hashes[bottom]) {
+        bottom--;
+    }
+
+    // positive shift: content moves up, negative shift: content moves down
+    int best_shift = 0;
+    // Require some savings, to cover for the cost of the scrolling sequences.
+    int best_gain = 8;
+
+    if (bottom > top) {
+        int in_place = 0;
+        for (int y = top; y <= bottom; y++) {
+            if (new_hashes[y] == old_hashes[y]) {
+                in_place += new_weights[y];
+            }
+        }
+
+        for (int shift = 1; shift <= bottom - top; shift++) {
+            int gain_up = -in_place;
+            int gain_down = -in_place;
+            for (int y = top; y <= bottom - shift; y++) {
+                if (new_hashes[y] == old_hashes[y + shift]) {
+                    gain_up += new_weights[y];
+                }
+                if (new_hashes[y + shift] == old_hashes[y]) {
+                    gain_down += new_weights[y + shift];
+                }
+            }
+            if (gain_up > best_gain) {
+                best_gain = gain_up;
+                best_shift = shift;
+            }
+            if (gain_down > best_gain) {
+                best_gain = gain_down;
+                best_shift = -shift;
+            }
+        }
+    }
+
+    free(hashes);
+    free(weights);
+
+    if (!best_shift) {
+        return;
+    }
+
+    const int shift = best_shift > 0 ? best_shift : -best_shift;
+    const bool margins = top != 0 || bottom != height - 1;
+
+    // inserted lines use the current background color
+    int_puts(term, "\033[m");
+    if (margins) {
+        int_puts(term, "\033[");
+        int_put_num(term, top + 1);
+        int_puts(term, ";");
+        int_put_num(term, bottom + 1);
+        int_puts(term, "r");
+    }
+    int_puts(term, "\033[");
+    int_put_num(term, top + 1);
+    int_puts(term, "H\033[");
+    int_put_num(term, shift);
+    // Use insert/delete line instead of SU/SD, because these are also supported by the linux vc.
+    int_puts(term, best_shift > 0 ? "M" : "L");
+    if (margins) {
+        int_puts(term, "\033[r");
+    }
+
+    cell *region = &term->primary.cells_last_flush[top * width];
+    const int region_rows = bottom - top + 1;
+    cell *exposed;
+    if (best_shift > 0) {
+        memmove(region, region + shift * width, (region_rows - shift) * width * sizeof(cell));
+        exposed = region + (region_rows - shift) * width;
+    } else {
+        memmove(region + shift * width, region, (region_rows - shift) * width * sizeof(cell));
+        exposed = region;
+    }
+    for (int i = 0; i < shift * width; i++) {
+        // style 0 has default colors and no attributes
+        memset(&exposed[i], 0, sizeof(cell));
+    }
+    termpaintp_surface_overflow_gc_mark_range(&term->primary, term->primary.cells_last_flush,
+                                              top * width, (bottom + 1) * width);
+    termpaintp_surface_style_gc_mark_range(&term->primary, term->primary.cells_last_flush,
+                                           top * width, (bottom + 1) * width);
+    termpaintp_surface_mark_rows_dirty(&term->primary, top, bottom);
+}
+
+static int termpaintp_decimal_digits(int num) {
+    int digits = 1;
+    while (num >= 10) {
+        num /= 10;
+        ++digits;
+    }
+    return digits;
+}
+
+static int termpaintp_csi_move_cost(int count) {
+    return 3 + (count != 1 ? termpaintp_decimal_digits(count) : 0);
+}
+
+static void termpaintp_terminal_csi_move(termpaint_terminal *term, int count, const char *final) {
+    int_puts(term, "\e[");
+    if (count != 1) {
+        int_put_num(term, count);
+    }
+    int_puts(term, final);
+}
+
+// Moves the cursor to column x in row y using the variant that needs the fewest bytes. The cursor currently is
+// rows_down rows above the target row or, if rows_down is 0, columns_right columns left of the target. When rows_down
+// is not 0 columns_right is x and column is the column the cursor currently is in, or -1 if that is not known (e.g.
+// because a wrap is pending after the last column). If speculation_len is positive, speculation contains the skipped
+// cells of the target row which can be printed again instead of moving.
+static void termpaintp_terminal_move_cursor_cheapest(termpaint_terminal *term, int x, int y, int rows_down,
+                                                     int columns_right, int column, const char *speculation,
+                                                     int speculation_len) {
+    enum { move_cr, move_keep_column, move_cha, move_cup } variant = move_cr;
+
+    // carriage return and line feeds or cursor down, then reprinting cells or cursor forward
+    int row_cost = 0;
+    bool use_line_feeds = false;
+    if (rows_down) {
+        const int cud_cost = termpaintp_csi_move_cost(rows_down);
+        use_line_feeds = rows_down < cud_cost;
+        row_cost = use_line_feeds ? rows_down : cud_cost;
+    }
+    int column_cost = 0;
+    bool use_speculation = false;
+    if (columns_right) {
+        column_cost = termpaintp_csi_move_cost(columns_right);
+        if (speculation_len > 0 && speculation_len <= column_cost) {
+            column_cost = speculation_len;
+            use_speculation = true;
+        }
+    }
+    int best_cost = (rows_down ? 1 : 0) + row_cost + column_cost;
+
+    if (rows_down && column >= 0) {
+        // line feeds or cursor down keep the column, then cursor forward or backward from there
+        const int keep_cost = row_cost + (x != column ? termpaintp_csi_move_cost(x > column ? x - column : column - x) : 0);
+        if (keep_cost < best_cost) {
+            variant = move_keep_column;
+            best_cost = keep_cost;
+        }
+        // or cursor character absolute, the column can be omitted for the first column
+        const int cha_cost = row_cost + 3 + (x ? termpaintp_decimal_digits(x + 1) : 0);
+        if (cha_cost < best_cost) {
+            variant = move_cha;
+            best_cost = cha_cost;
+        }
+    }
+
+    // absolute: cursor position, the column can be omitted for the first column
+    const int cup_cost = 3 + termpaintp_decimal_digits(y + 1) + (x ? 1 + termpaintp_decimal_digits(x + 1) : 0);
+    if (cup_cost < best_cost) {
+        variant = move_cup;
+    }
+
+    if (variant == move_cup) {
+        if (x) {
+            termpaintp_terminal_set_cursor(term, x, y);
+        } else {
+            int_puts(term, "\e[");
+            int_put_num(term, y + 1);
+            int_puts(term, "H");
+        }
+        return;
+    }
+
+    if (rows_down) {
+        if (variant == move_cr) {
+            int_puts(term, "\r");
+        }
+        if (use_line_feeds) {
+            for (int i = 0; i < rows_down; i++) {
+                int_puts(term, "\n");
+            }
+        } else {
+            termpaintp_terminal_csi_move(term, rows_down, "B");
+        }
+    }
+    if (variant == move_keep_column) {
+        if (x > column) {
+            termpaintp_terminal_csi_move(term, x - column, "C");
+        } else if (x < column) {
+            termpaintp_terminal_csi_move(term, column - x, "D");
+        }
+    } else if (variant == move_cha) {
+        int_puts(term, "\e[");
+        if (x) {
+            int_put_num(term, x + 1);
+        }
+        int_puts(term, "G");
+    } else if (columns_right) {
+        if (use_speculation) {
+            int_write(term, speculation, speculation_len);
+        } else {
+            termpaintp_terminal_csi_move(term, columns_right, "C");
+        }
+    }
+}
+
+static bool termpaintp_cell_same_content(const cell *a, const cell *b) {
+    if (a->style != b->style || a->flags != b->flags
+            || a->cluster_expansion != b->cluster_expansion || a->text_len != b->text_len) {
+        return false;
+    }
+    if (a->text_len) {
+        return memcmp(a->text, b->text, a->text_len) == 0;
+    }
+    return a->text_overflow == b->text_overflow;
+}
+
+// Counts the cells directly after x (up to end) that repeat the cell at x and differ from what the
+// terminal currently displays. displayed is what the terminal displays at x after painting it.
+static int termpaintp_flush_repeat_count(termpaint_terminal *term, const cell *displayed, int x, int y, int end,
+                                         bool full_repaint) {
+    const cell *c = termpaintp_getcell(&term->primary, x, y);
+    int count = 0;
+    for (int i = x + 1; i < end; i++) {
+        const cell *next = termpaintp_getcell(&term->primary, i, y);
+        if (!termpaintp_cell_same_content(c, next)) {
+            break;
+        }
+        if (!full_repaint && termpaintp_cell_same_content(displayed, &term->primary.cells_last_flush[y*term->primary.width+i])) {
+            break;
+        }
+        ++count;
+    }
+    return count;
+}
+
+static void termpaintp_terminal_flush_colors(termpaint_terminal *term) {
+    if (term->colors_dirty) {
+        termpaint_color_entry *entry = term->colors_dirty;
+        term->colors_dirty = nullptr;
+        while (entry) {
+            termpaint_color_entry *next = entry->next_dirty;
+            entry->dirty = false;
+            entry->next_dirty = nullptr;
+            if (entry->requested.len) {
+                int_puts(term, "\033]");
+                int_uputs(term, entry->base.text);
+                int_puts(term, ";");
+                int_uputs(term, entry->requested.data);
+                int_puts(term, termpaintp_terminal_correct_string_terminator(term));
+            } else {
+                int_uputs(term, entry->restore.data);
             }
+            entry = next;
         }
     }
-    return color;
 }
 
-typedef struct {
-    int index;
-    int max;
-} termpaintp_sgr_params;
-
-static inline void write_color_sgr_values(termpaint_integration *integration, termpaintp_sgr_params *params, uint32_t color, char *direct, char *indexed, char *sep, unsigned named, unsigned bright_named) {
-    if ((color & 0xff000000) == TERMPAINT_RGB_COLOR_OFFSET) {
-        if (params->index + 5 >= params->max) {
-            int_puts(integration, "m\033[");
-            params->index = 0;
-            int_puts(integration, direct + 1); // skip first ";"
-        } else {
-            int_puts(integration, direct);
+// Returns a mask with bit i set if the bytes of a[i] and b[i] differ, for n <= 64 cells.
+static uint64_t termpaintp_cells_differ_mask(const cell *a, const cell *b, int n) {
+    uint64_t mask = 0;
+    int i = 0;
+#ifdef __SSE2__
+    if (sizeof(cell) == 16) {
+        // each cell is exactly one 16 byte vector
+        for (; i < n; i++) {
+            const __m128i va = _mm_loadu_si128((const __m128i*)(const void*)(a + i));
+            const __m128i vb = _mm_loadu_si128((const __m128i*)(const void*)(b + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff) {
+                mask |= (uint64_t)1 << i;
+            }
         }
-        int_put_num(integration, (color >> 16) & 0xff);
-        int_puts(integration, sep);
-        int_put_num(integration, (color >> 8) & 0xff);
-        int_puts(integration, sep);
-        int_put_num(integration, (color) & 0xff);
-        params->index += 5;
-    } else if (TERMPAINT_INDEXED_COLOR <= color && TERMPAINT_INDEXED_COLOR + 255 >= color) {
-        if (params->index + 3 >= params->max) {
-            int_puts(integration, "m\033[");
-            params->index = 0;
-            int_puts(integration, indexed + 1); // skip first ";"
-        } else {
-            int_puts(integration, indexed);
+    }
+#endif
+    for (; i < n; i++) {
+        if (memcmp(a + i, b + i, sizeof(cell)) != 0) {
+            mask |= (uint64_t)1 << i;
         }
-        int_put_num(integration, (color) & 0xff);
-        params->index += 3;
-    } else {
-        if (named) {
-            if (TERMPAINT_NAMED_COLOR <= color && TERMPAINT_NAMED_COLOR + 7 >= color) {
-                if (params->index + 1 >= params->max) {
-                    int_puts(integration, "m\033[");
-                    params->index = 0;
-                } else {
-                    int_puts(integration, ";");
-                }
-                int_put_num(integration, named + (color - TERMPAINT_NAMED_COLOR));
-                params->index += 1;
-            } else if (TERMPAINT_NAMED_COLOR + 8 <= color && TERMPAINT_NAMED_COLOR + 15 >= color) {
-                if (params->index + 1 >= params->max) {
-                    int_puts(integration, "m\033[");
-                    params->index = 0;
-                } else {
-                    int_puts(integration, ";");
-                }
-                int_put_num(integration, bright_named + (color - (TERMPAINT_NAMED_COLOR + 8)));
-                params->index += 1;
+    }
+    return mask;
+}
+
+// Returns a mask with bit i set if cell x0 + i (for n <= 64 cells) in row y of the primary surface might differ
+// from the last flush. Cells covered by multi cell clusters are stored as hidden cells in cells_last_flush, these
+// are only reported if the marker is missing.
+static uint64_t termpaintp_terminal_changed_cells(termpaint_terminal *term, int y, int x0, int n) {
+    const cell *row = &term->primary.cells[y * term->primary.width + x0];
+    const cell *row_last_flush = &term->primary.cells_last_flush[y * term->primary.width + x0];
+    uint64_t mask = termpaintp_cells_differ_mask(row, row_last_flush, n);
+    uint64_t pending = mask;
+    while (pending) {
+        const int i = termpaint_ctz64(pending);
+        pending &= pending - 1;
+        if (row[i].text_len == 0 && row[i].text_overflow == WIDE_RIGHT_PADDING
+                && row_last_flush[i].text_len == 1 && row_last_flush[i].text[0] == '\x01') {
+            mask &= ~((uint64_t)1 << i);
+        }
+    }
+    if (!term->cache_should_use_truecolor && !term->double_buffered) {
+        // cells_last_flush contains quantized colors, rgb colors can only match if they were flushed before
+        // truecolor support was revoked.
+        for (int i = 0; i < n; i++) {
+            if (mask & ((uint64_t)1 << i)) {
+                continue;
             }
-        } else {
-            if (TERMPAINT_NAMED_COLOR <= color && TERMPAINT_NAMED_COLOR + 15 >= color) {
-                if (params->index + 3 >= params->max) {
-                    int_puts(integration, "m\033[");
-                    params->index = 0;
-                    int_puts(integration, indexed + 1); // skip first ";"
-                } else {
-                    int_puts(integration, indexed);
-                }
-                int_put_num(integration, (color - TERMPAINT_NAMED_COLOR));
-                params->index += 3;
+            const termpaintp_style *style = termpaintp_surface_style(&term->primary, row[i].style);
+            if ((style->fg_color & 0xff000000) == TERMPAINT_RGB_COLOR_OFFSET
+                    || (style->bg_color & 0xff000000) == TERMPAINT_RGB_COLOR_OFFSET) {
+                mask |= (uint64_t)1 << i;
             }
         }
     }
+    return mask;
 }
 
-void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
-    termpaint_integration *integration = term->integration;
-    full_repaint |= term->force_full_repaint;
+// Checks if a row of the primary surface is identical to the last flush without comparing cells field by field.
+static bool termpaintp_terminal_row_unchanged(termpaint_terminal *term, int y) {
+    for (int x = 0; x < term->primary.width; x += 64) {
+        const int n = term->primary.width - x < 64 ? term->primary.width - x : 64;
+        if (termpaintp_terminal_changed_cells(term, y, x, n)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the first cluster start in [x, limit) that might differ from the last flush or limit if there is none.
+// x must be the start of a cluster. mask and mask_x0 cache the mask of 64 cells starting at mask_x0 between calls
+// for the same row and have to be reset to 0 and -64 for each row.
+static int termpaintp_terminal_skip_unchanged_cells(termpaint_terminal *term, int y, int x, int limit,
+                                                    uint64_t *mask, int *mask_x0) {
+    int next = x;
+    while (next < limit) {
+        if (next >= *mask_x0 + 64) {
+            *mask_x0 = next;
+            *mask = termpaintp_terminal_changed_cells(term, y, next, limit - next < 64 ? limit - next : 64);
+        }
+        const uint64_t pending = *mask >> (next - *mask_x0);
+        if (pending) {
+            next += termpaint_ctz64(pending);
+            break;
+        }
+        next = *mask_x0 + 64;
+    }
+    if (next > limit) {
+        next = limit;
+    }
+    while (next > x && next < term->primary.width) {
+        // limit or a cell with a missing hidden marker might be inside of a cluster
+        const cell *c = termpaintp_getcell(&term->primary, next, y);
+        if (c->text_len != 0 || c->text_overflow != WIDE_RIGHT_PADDING) {
+            break;
+        }
+        --next;
+    }
+    return next;
+}
+
+static int64_t termpaintp_terminal_clock_ns(termpaint_terminal *term) {
+    if (term->integration_vtbl->monotonic_clock_ns) {
+        return term->integration_vtbl->monotonic_clock_ns(term->integration);
+    }
+    return 0;
+}
+
+// Paints the cells in [x0, x1) x [y0, y1) of the primary surface that differ from cells_last_flush.
+// If swap_buffers is set, the region has to be the whole surface and cells_last_flush is not updated while painting
+// but swapped with the cells of the surface at the end (only in double buffered mode).
+static void termpaintp_terminal_flush_region(termpaint_terminal *term, bool full_repaint, bool swap_buffers,
+                                             int x0, int y0, int x1, int y1) {
+    const bool whole_surface = x0 == 0 && y0 == 0 && x1 == term->primary.width && y1 == term->primary.height;
+    const bool full_rows = x0 == 0 && x1 == term->primary.width;
+    termpaint_flush_stats *stats = &term->flush_stats;
+    memset(stats, 0, sizeof(*stats));
+    const int64_t start_time = termpaintp_terminal_clock_ns(term);
+    // displayed styles are only referenced by local variables until stored in cells_last_flush
+    term->primary.styles.gc_blocked++;
+    term->flush_stats_bytes = &stats->bytes_misc;
+    int_begin_buffering(term);
+    const bool synchronized = termpaint_terminal_capable(term, TERMPAINT_CAPABILITY_SYNCHRONIZED_OUTPUT);
+    if (synchronized) {
+        // begin synchronized update, the terminal delays rendering until the matching end
+        int_puts(term, "\033[?2026h");
+    }
     termpaintp_terminal_hide_cursor(term);
-    int_puts(integration, "\e[H");
+    term->flush_stats_bytes = &stats->bytes_movement;
+    if (!full_repaint && whole_surface && termpaint_terminal_capable(term, TERMPAINT_CAPABILITY_SCROLL_REGION)) {
+        termpaintp_terminal_scroll_optimize(term);
+    }
+    int_puts(term, "\e[H");
+    // column of the cursor while rows are pending, -1 if not known
+    int cursor_column = 0;
     char speculation_buffer[30];
     int speculation_buffer_state = 0; // 0 = cursor position matches current cell, -1 = force move, > 0 bytes to print instead of move
-    int pending_row_move = 0;
+    int pending_row_move = y0;
     int pending_colum_move = 0;
     int pending_colum_move_digits = 1;
     int pending_colum_move_digits_step = 10;
 
     enum { sw_no, sw_single, sw_double } softwrap_prev = sw_no, softwrap = sw_no;
 
-    for (int y = 0; y < term->primary.height; y++) {
+    // Active attributes in the terminal, kept across rows. -1 means unknown.
+    uint32_t current_fg = -1;
+    uint32_t current_bg = -1;
+    uint32_t current_deco = -1;
+    uint32_t current_flags = -1;
+    uint32_t current_patch_idx = 0; // patch index is special because it could do anything.
+
+    const bool use_rep = termpaint_terminal_capable(term, TERMPAINT_CAPABILITY_REPEAT_CHAR);
+    // erased cells get the current background color, so ECH needs background color erase.
+    const bool use_ech = termpaint_terminal_capable(term, TERMPAINT_CAPABILITY_ERASE_CHAR)
+            && termpaint_terminal_capable(term, TERMPAINT_CAPABILITY_CLEARED_COLORING);
+
+    for (int y = y0; y < y1; y++) {
         speculation_buffer_state = 0;
         pending_colum_move = 0;
         pending_colum_move_digits = 1;
         pending_colum_move_digits_step = 10;
 
-        uint32_t current_fg = -1;
-        uint32_t current_bg = -1;
-        uint32_t current_deco = -1;
-        uint32_t current_flags = -1;
-        uint32_t current_patch_idx = 0; // patch index is special because it could do anything.
         bool cleared = false;
 
         softwrap = sw_no;
-        if (y+1 < term->primary.height && term->primary.width) {
+        // soft wrapping can only be preserved when painting complete rows
+        if (full_rows && y+1 < term->primary.height && term->primary.width) {
             cell* first_next_line = termpaintp_getcell(&term->primary, 0, y + 1);
             if (first_next_line->flags & CELL_SOFTWRAP_MARKER
                     && (first_next_line->text_len || first_next_line->text_overflow != nullptr)) {
@@ -2363,13 +3648,22 @@ void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
             }
         }
 
+        if (!full_repaint && softwrap == sw_no && softwrap_prev == sw_no
+                && (!term->primary.dirty_rows[y] || (full_rows && termpaintp_terminal_row_unchanged(term, y)))) {
+            // Row did not change since the last flush or was redrawn with the same contents, the terminal already
+            // displays it.
+            ++stats->rows_skipped;
+            pending_row_move += 1;
+            continue;
+        }
+
         int first_noncopy_space = term->primary.width;
-        if (termpaint_terminal_capable(term, TERMPAINT_CAPABILITY_CLEARED_COLORING)) {
+        if (x1 == term->primary.width && termpaint_terminal_capable(term, TERMPAINT_CAPABILITY_CLEARED_COLORING)) {
             if (softwrap == sw_no) {
                 for (int x = term->primary.width - 1; x >= 0; x--) {
                     cell* c = termpaintp_getcell(&term->primary, x, y);
                     if ((c->text_len == 0 && c->text_overflow == nullptr)
-                            && (c->flags & CELL_ATTR_INVERSE) == 0) {
+                            && (termpaintp_surface_style(&term->primary, c->style)->flags & CELL_ATTR_INVERSE) == 0) {
                         first_noncopy_space = x;
                     } else {
                         break;
@@ -2378,9 +3672,78 @@ void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
             }
         }
 
-        for (int x = 0; x < term->primary.width; x++) {
+        int x_start = x0;
+        while (x_start > 0) {
+            // start at the beginning of a multi cell cluster that is cut by the region
+            cell* c = termpaintp_getcell(&term->primary, x_start, y);
+            if (c->text_len != 0 || c->text_overflow != WIDE_RIGHT_PADDING) {
+                if (!term->double_buffered) {
+                    break;
+                }
+                // Also include clusters on the terminal that would be partially overwritten. There are no hidden
+                // cell markers in this mode to have them painted again later.
+                cell* old_c = &term->primary.cells_last_flush[y*term->primary.width+x_start];
+                if (old_c->text_len != 0 || old_c->text_overflow != WIDE_RIGHT_PADDING) {
+                    break;
+                }
+            }
+            --x_start;
+        }
+        if (x_start) {
+            // skipped cells left of the region are not collected, so speculation can not be used in this row.
+            pending_colum_move = x_start;
+            speculation_buffer_state = -1;
+
+            // A cluster on the terminal that starts left of the region and is partially overwritten gets erased by
+            // the terminal. Mark its start as hidden so it is painted again by a later flush.
+            cell* row_last_flush = &term->primary.cells_last_flush[y*term->primary.width];
+            for (int x = x_start; x > 0 && row_last_flush[x].text_len == 1 && row_last_flush[x].text[0] == '\x01'; x--) {
+                cell* start = &row_last_flush[x - 1];
+                if (start->cluster_expansion) {
+                    start->cluster_expansion = 0;
+                    start->text_len = 1;
+                    start->text[0] = '\x01';
+                    break;
+                }
+            }
+        }
+
+        int x_end = x1;
+        while (term->double_buffered && x_end < term->primary.width) {
+            // Same for a cluster on the terminal that extends over the end of the region.
+            cell* old_c = &term->primary.cells_last_flush[y*term->primary.width+x_end];
+            if (old_c->text_len != 0 || old_c->text_overflow != WIDE_RIGHT_PADDING) {
+                break;
+            }
+            ++x_end;
+        }
+
+        // Cells before skip_limit that did not change only need to be tracked as cursor movement. Later cells might need
+        // painting for the cleared tail or soft wrapping.
+        int skip_limit = first_noncopy_space + 1 < x_end ? first_noncopy_space + 1 : x_end;
+        if (softwrap != sw_no && skip_limit > term->primary.width - 2) {
+            skip_limit = term->primary.width - 2;
+        }
+
+        uint64_t changed_mask = 0;
+        int changed_mask_x0 = -64;
+
+        int x = x_start;
+        for (; x < x_end; x++) {
+            if (!full_repaint && speculation_buffer_state == -1 && !current_patch_idx && softwrap_prev == sw_no
+                    && x < skip_limit) {
+                const int next = termpaintp_terminal_skip_unchanged_cells(term, y, x, skip_limit,
+                                                                          &changed_mask, &changed_mask_x0);
+                stats->cells_scanned += next - x;
+                pending_colum_move += next - x;
+                x = next;
+                if (x >= x_end) {
+                    break;
+                }
+            }
             cell* c = termpaintp_getcell(&term->primary, x, y);
             cell* old_c = &term->primary.cells_last_flush[y*term->primary.width+x];
+            ++stats->cells_scanned;
             int code_units;
             bool text_changed;
             const unsigned char* text;
@@ -2401,23 +3764,30 @@ void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
                 }
             }
 
-            uint32_t effective_fg_color = termpaintp_quantize_color(term, c->fg_color);
-            uint32_t effective_bg_color = termpaintp_quantize_color(term, c->bg_color);
+            const uint32_t displayed_style = termpaintp_terminal_displayed_style(term, c->style);
+            const uint32_t old_displayed_style = term->double_buffered
+                    ? termpaintp_terminal_displayed_style(term, old_c->style) : old_c->style;
+            const termpaintp_style effective = *termpaintp_surface_style(&term->primary, displayed_style);
+
+            bool style_changed = displayed_style != old_displayed_style;
+            if (style_changed && !(effective.flags & CELL_ATTR_DECO_MASK)) {
+                // the decoration color does not matter without underline
+                const termpaintp_style *old_effective = termpaintp_surface_style(&term->primary, old_displayed_style);
+                style_changed = effective.fg_color != old_effective->fg_color
+                        || effective.bg_color != old_effective->bg_color || effective.flags != old_effective->flags
+                        || effective.patch_idx != old_effective->patch_idx;
+            }
 
-            bool needs_paint = full_repaint || effective_bg_color != old_c->bg_color || effective_fg_color != old_c->fg_color
-                    || c->flags != old_c->flags || c->attr_patch_idx != old_c->attr_patch_idx || text_changed;
+            bool needs_paint = full_repaint || style_changed || c->flags != old_c->flags || text_changed;
 
-            uint32_t effective_deco_color;
-            if (c->flags & CELL_ATTR_DECO_MASK) {
-                effective_deco_color = c->deco_color;
-                needs_paint |= effective_deco_color != old_c->deco_color;
-            } else {
-                effective_deco_color = TERMPAINT_DEFAULT_COLOR;
-            }
+            const uint32_t effective_fg_color = effective.fg_color;
+            const uint32_t effective_bg_color = effective.bg_color;
+            const uint32_t effective_deco_color = effective.flags & CELL_ATTR_DECO_MASK ? effective.deco_color
+                                                                                       : TERMPAINT_DEFAULT_COLOR;
 
             bool needs_attribute_change = effective_bg_color != current_bg || effective_fg_color != current_fg
-                    || effective_deco_color != current_deco || (c->flags & CELL_ATTR_MASK) != current_flags
-                    || c->attr_patch_idx != current_patch_idx;
+                    || effective_deco_color != current_deco || effective.flags != current_flags
+                    || effective.patch_idx != current_patch_idx;
 
             if (first_noncopy_space < x) {
                 needs_paint = needs_attribute_change || (needs_paint && !cleared);
@@ -2425,20 +3795,22 @@ void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
 
             if (softwrap == sw_single && x == term->primary.width - 1) {
                 needs_paint = true;
+                term->flush_stats_bytes = &stats->bytes_misc;
                 if (term->did_terminal_disable_wrap) {
                     // terminals like urxvt, screen and libvterm need this before the cursor goes
                     // into pending wrap state.
-                    int_puts(integration, "\033[?7h");
+                    int_puts(term, "\033[?7h");
                 }
             }
 
             if (softwrap == sw_double && x == term->primary.width - 2) {
                 needs_paint = true;
                 x += 1; // skip last cell
+                term->flush_stats_bytes = &stats->bytes_misc;
                 if (term->did_terminal_disable_wrap) {
                     // terminals like urxvt, screen and libvterm need this before the cursor goes
                     // into pending wrap state.
-                    int_puts(integration, "\033[?7h");
+                    int_puts(term, "\033[?7h");
                 }
             }
 
@@ -2446,18 +3818,34 @@ void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
                 needs_paint = true;
             }
 
-            *old_c = *c;
-            old_c->bg_color = effective_bg_color;
-            old_c->fg_color = effective_fg_color;
-            for (int i = 0; i < c->cluster_expansion; i++) {
-                cell* wipe_c = &term->primary.cells_last_flush[y*term->primary.width+x+i+1];
-                wipe_c->text_len = 1;
-                wipe_c->text[0] = '\x01'; // impossible value, filtered out earlier in output pipeline
+            // what the terminal displays after this cell is painted
+            cell displayed = *c;
+            displayed.style = displayed_style;
+            if (term->double_buffered) {
+                if (!swap_buffers) {
+                    memcpy(old_c, c, (1 + c->cluster_expansion) * sizeof(cell));
+                    // a cluster that extends over the end of the region can partially overwrite another one.
+                    if (x + 1 + c->cluster_expansion > x_end) {
+                        x_end = x + 1 + c->cluster_expansion;
+                        while (x_end < term->primary.width
+                               && old_c[x_end - x].text_len == 0 && old_c[x_end - x].text_overflow == WIDE_RIGHT_PADDING) {
+                            ++x_end;
+                        }
+                    }
+                }
+            } else {
+                *old_c = displayed;
+                for (int i = 0; i < c->cluster_expansion; i++) {
+                    cell* wipe_c = &term->primary.cells_last_flush[y*term->primary.width+x+i+1];
+                    wipe_c->text_len = 1;
+                    wipe_c->text[0] = '\x01'; // impossible value, filtered out earlier in output pipeline
+                }
             }
 
             if (!needs_paint) {
                 if (current_patch_idx) {
-                    int_uputs(integration, term->primary.patches[current_patch_idx-1].cleanup);
+                    term->flush_stats_bytes = &stats->bytes_sgr;
+                    int_uputs(term, termpaintp_surface_patch(&term->primary, current_patch_idx)->cleanup);
                     current_patch_idx = 0;
                 }
 
@@ -2477,6 +3865,7 @@ void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
                             speculation_buffer_state = -1;
                         } else if (speculation_buffer_state + code_units < (int)sizeof (speculation_buffer)) {
                             memcpy(speculation_buffer + speculation_buffer_state, (char*)text, code_units);
+                            speculation_buffer_state += code_units;
                         } else {
                             // speculation buffer to small
                             speculation_buffer_state = -1;
@@ -2486,30 +3875,13 @@ void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
                 x += c->cluster_expansion;
                 continue;
             } else {
-                if (pending_row_move) {
-                    int_puts(integration, "\r");
-                    if (pending_row_move < 4) {
-                        while (pending_row_move) {
-                            int_puts(integration, "\n");
-                            --pending_row_move;
-                        }
-                    } else {
-                        int_puts(integration, "\e[");
-                        int_put_num(integration, pending_row_move);
-                        int_puts(integration, "B");
-                        pending_row_move = 0;
-                    }
-                }
-                if (pending_colum_move) {
-                    if (speculation_buffer_state > 0) {
-                        int_write(integration, speculation_buffer, speculation_buffer_state);
-                    } else {
-                        int_puts(integration, "\e[");
-                        if (pending_colum_move != 1) {
-                            int_put_num(integration, pending_colum_move);
-                        }
-                        int_puts(integration, "C");
-                    }
+                if (pending_row_move || pending_colum_move) {
+                    ++stats->cursor_moves;
+                    term->flush_stats_bytes = &stats->bytes_movement;
+                    termpaintp_terminal_move_cursor_cheapest(term, x, y, pending_row_move, pending_colum_move,
+                                                             cursor_column, speculation_buffer,
+                                                             speculation_buffer_state);
+                    pending_row_move = 0;
                     speculation_buffer_state = 0;
                     pending_colum_move = 0;
                     pending_colum_move_digits = 1;
@@ -2518,114 +3890,140 @@ void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
             }
 
             if (needs_attribute_change) {
-                int_puts(integration, "\e[0");
-                termpaintp_sgr_params params;
-                params.index = 1;
-                params.max = term->max_csi_parameters;
-#define PUT_PARAMETER(s)                        \
-    do { if (params.index + 1 >= params.max) {  \
-        int_puts(integration, "m\033[");        \
-        int_puts(integration, s + 1);           \
-        params.index = 1;                       \
-    } else {                                    \
-        int_puts(integration, s);               \
-        params.index += 1;                      \
-    } } while (false)                           \
-    /* end macro */
-                write_color_sgr_values(integration, &params, effective_bg_color, ";48;2;", ";48;5;", ";", 40, 100);
-                write_color_sgr_values(integration, &params, effective_fg_color, ";38;2;", ";38;5;", ";", 30, 90);
-                write_color_sgr_values(integration, &params, effective_deco_color, ";58:2:", ";58:5:", ":", 0, 0);
-                if (c->flags) {
-                    if (c->flags & CELL_ATTR_BOLD) {
-                        PUT_PARAMETER(";1");
-                    }
-                    if (c->flags & CELL_ATTR_ITALIC) {
-                        PUT_PARAMETER(";3");
-                    }
-                    uint32_t underline = c->flags & CELL_ATTR_UNDERLINE_MASK;
-                    if (underline == CELL_ATTR_UNDERLINE_SINGLE) {
-                        PUT_PARAMETER(";4");
-                    } else if (underline == CELL_ATTR_UNDERLINE_DOUBLE) {
-                        PUT_PARAMETER(";21");
-                    } else if (underline == CELL_ATTR_UNDERLINE_CURLY) {
-                        // TODO maybe filter this by terminal capability somewhere?
-                        if (params.index + 2 >= params.max) {
-                            int_puts(integration, "m\033[");
-                            int_puts(integration, "4:3");
-                            params.index = 2;
-                        } else {
-                            int_puts(integration, ";4:3");
-                            params.index += 2;
-                        }
-                    }
-                    if (c->flags & CELL_ATTR_BLINK) {
-                        PUT_PARAMETER(";5");
-                    }
-                    if (c->flags & CELL_ATTR_OVERLINE) {
-                        PUT_PARAMETER(";53");
-                    }
-                    if (c->flags & CELL_ATTR_INVERSE) {
-                        PUT_PARAMETER(";7");
-                    }
-                    if (c->flags & CELL_ATTR_STRIKE) {
-                        PUT_PARAMETER(";9");
-                    }
-                }
-                int_puts(integration, "m");
-#undef PUT_PARAMETER
+                ++stats->attribute_changes;
+                term->flush_stats_bytes = &stats->bytes_sgr;
+                // Patches could do anything, so only use a delta when the active attributes are known.
+                const bool known = !current_patch_idx && !effective.patch_idx;
+                termpaintp_terminal_write_sgr(term, current_bg, current_fg, current_deco, known ? current_flags : (uint32_t)-1,
+                                              effective_bg_color, effective_fg_color, effective_deco_color,
+                                              effective.flags);
                 current_bg = effective_bg_color;
                 current_fg = effective_fg_color;
                 current_deco = effective_deco_color;
-                current_flags = c->flags & CELL_ATTR_MASK;
+                current_flags = effective.flags;
 
-                if (current_patch_idx != c->attr_patch_idx) {
+                if (current_patch_idx != effective.patch_idx) {
                     if (current_patch_idx) {
-                        int_uputs(integration, term->primary.patches[current_patch_idx-1].cleanup);
+                        int_uputs(term, termpaintp_surface_patch(&term->primary, current_patch_idx)->cleanup);
                     }
-                    if (c->attr_patch_idx) {
-                        int_uputs(integration, term->primary.patches[c->attr_patch_idx-1].setup);
+                    if (effective.patch_idx) {
+                        int_uputs(term, termpaintp_surface_patch(&term->primary, effective.patch_idx)->setup);
                     }
                 }
 
-                current_patch_idx = c->attr_patch_idx;
+                current_patch_idx = effective.patch_idx;
+            }
+            // Runs of identical cells can be sent as REP (repeat the preceding character) or, for blank
+            // cells, as ECH (erase without moving the cursor, so a cursor movement has to follow).
+            int repeat = 0;
+            bool erase = false;
+            if ((use_rep || use_ech) && first_noncopy_space > x && !effective.patch_idx && !c->cluster_expansion) {
+                int run_end = first_noncopy_space < x_end ? first_noncopy_space : x_end;
+                if (softwrap != sw_no && run_end > term->primary.width - 2) {
+                    run_end = term->primary.width - 2;
+                }
+                repeat = termpaintp_flush_repeat_count(term, &displayed, x, y, run_end, full_repaint);
+                // compare bytes needed to send the repeated cells, the first cell is always printed for REP.
+                int best_cost = repeat * code_units;
+                bool encoded = false;
+                if (repeat && use_rep && termpaintp_utf8_len(text[0]) == code_units) {
+                    const int rep_cost = 3 + (repeat != 1 ? termpaintp_decimal_digits(repeat) : 0);
+                    if (rep_cost < best_cost) {
+                        best_cost = rep_cost;
+                        encoded = true;
+                    }
+                }
+                if (repeat && use_ech && softwrap_prev == sw_no
+                        && c->text_len == 0 && c->text_overflow == nullptr && effective.flags == 0) {
+                    // ECH also covers the first cell, but needs a cursor movement afterwards.
+                    const int ech_cost = 2 * (3 + termpaintp_decimal_digits(repeat + 1));
+                    if (ech_cost < code_units + best_cost) {
+                        encoded = true;
+                        erase = true;
+                    }
+                }
+                if (!encoded) {
+                    repeat = 0;
+                }
+                if (term->double_buffered) {
+                    if (!swap_buffers) {
+                        memcpy(old_c + 1, c + 1, repeat * sizeof(cell));
+                    }
+                } else {
+                    for (int i = 1; i <= repeat; i++) {
+                        term->primary.cells_last_flush[y*term->primary.width+x+i] = displayed;
+                    }
+                }
             }
+
+            term->flush_stats_bytes = &stats->bytes_text;
+            stats->cells_painted += 1 + repeat;
             if (first_noncopy_space <= x) {
-                int_write(integration, "\033[K", 3);
+                int_write(term, "\033[K", 3);
                 pending_colum_move++;
                 speculation_buffer_state = -1;
                 cleared = true;
+            } else if (erase) {
+                int_puts(term, "\e[");
+                int_put_num(term, repeat + 1);
+                int_puts(term, "X");
+                pending_colum_move += repeat + 1;
+                speculation_buffer_state = -1;
+                x += repeat;
             } else {
-                int_write(integration, (char*)text, code_units);
+                int_write(term, (char*)text, code_units);
+                if (repeat) {
+                    int_puts(term, "\e[");
+                    if (repeat != 1) {
+                        int_put_num(term, repeat);
+                    }
+                    int_puts(term, "b");
+                    x += repeat;
+                }
                 if (softwrap_prev != sw_no) {
                     softwrap_prev = sw_no;
                     if (term->did_terminal_disable_wrap) {
-                        int_puts(integration, "\033[?7l");
+                        term->flush_stats_bytes = &stats->bytes_misc;
+                        int_puts(term, "\033[?7l");
+                        term->flush_stats_bytes = &stats->bytes_text;
                     }
                 }
 
                 if (softwrap == sw_double && x == term->primary.width - 1) {
                     // clear gap cell when a double width character causes wrap
-                    int_write(integration, "\033[K", 3);
+                    int_write(term, "\033[K", 3);
                 }
             }
             if (current_patch_idx) {
-                if (!term->primary.patches[c->attr_patch_idx-1].optimize) {
-                    int_uputs(integration, term->primary.patches[c->attr_patch_idx-1].cleanup);
+                if (!termpaintp_surface_patch(&term->primary, effective.patch_idx)->optimize) {
+                    term->flush_stats_bytes = &stats->bytes_sgr;
+                    int_uputs(term, termpaintp_surface_patch(&term->primary, effective.patch_idx)->cleanup);
                     current_patch_idx = 0;
                 }
             }
             x += c->cluster_expansion;
         }
+        if (!pending_row_move) {
+            // The row was painted, pending column moves count from the cursor. After the last column a wrap might be
+            // pending, where terminals differ in how relative movement works.
+            cursor_column = x - pending_colum_move;
+            if (cursor_column >= term->primary.width) {
+                cursor_column = -1;
+            }
+        }
 
         if (current_patch_idx) {
-            int_uputs(integration, term->primary.patches[current_patch_idx-1].cleanup);
+            term->flush_stats_bytes = &stats->bytes_sgr;
+            int_uputs(term, termpaintp_surface_patch(&term->primary, current_patch_idx)->cleanup);
             current_patch_idx = 0;
         }
 
         if (softwrap == sw_no) {
             if (full_repaint) {
+                term->flush_stats_bytes = &stats->bytes_movement;
                 if (y+1 < term->primary.height) {
-                    int_puts(integration, "\r\n");
+                    int_puts(term, "\r\n");
+                    cursor_column = 0;
                 }
             } else {
                 pending_row_move += 1;
@@ -2634,59 +4032,182 @@ void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
 
         softwrap_prev = softwrap;
     }
-    if (pending_row_move > 1) {
+    if (swap_buffers) {
+        // The terminal now displays the contents of cells. The previous frame becomes the surface to draw the next
+        // frame into, so all rows differ from the last flush until redrawn.
+        cell *flushed = term->primary.cells;
+        term->primary.cells = term->primary.cells_last_flush;
+        term->primary.cells_last_flush = flushed;
+        termpaintp_surface_mark_rows_dirty(&term->primary, 0, term->primary.height - 1);
+    } else if (full_rows) {
+        // rows only partially painted still might have changes
+        for (int y = y0; y < y1; y++) {
+            term->primary.dirty_rows[y] = false;
+        }
+    }
+    term->flush_stats_bytes = &stats->bytes_movement;
+    const bool cursor_placed = term->cursor_x != -1 && term->cursor_y != -1;
+    if (pending_row_move > 1 && !cursor_placed) { // the cursor position replaces any relative movement
         --pending_row_move; // don't move after paint rect
-        int_puts(integration, "\r");
+        ++stats->cursor_moves;
+        int_puts(term, "\r");
         if (pending_row_move < 4) {
             while (pending_row_move) {
-                int_puts(integration, "\n");
+                int_puts(term, "\n");
                 --pending_row_move;
             }
         } else {
-            int_puts(integration, "\e[");
-            int_put_num(integration, pending_row_move);
-            int_puts(integration, "B");
+            int_puts(term, "\e[");
+            int_put_num(term, pending_row_move);
+            int_puts(term, "B");
         }
     }
 
-    if (term->cursor_x != -1 && term->cursor_y != -1) {
+    if (cursor_placed) {
+        ++stats->cursor_moves;
         termpaintp_terminal_set_cursor(term, term->cursor_x, term->cursor_y);
     } else {
         if (pending_colum_move) {
-            int_puts(integration, "\e[");
+            ++stats->cursor_moves;
+            int_puts(term, "\e[");
             if (pending_colum_move != 1) {
-                int_put_num(integration, pending_colum_move);
+                int_put_num(term, pending_colum_move);
             }
-            int_puts(integration, "C");
+            int_puts(term, "C");
         }
     }
 
+    term->flush_stats_bytes = &stats->bytes_misc;
     termpaintp_terminal_update_cursor_style(term);
 
     if (term->cursor_visible) {
         termpaintp_terminal_show_cursor(term);
     }
-    if (term->colors_dirty) {
-        termpaint_color_entry *entry = term->colors_dirty;
-        term->colors_dirty = nullptr;
-        while (entry) {
-            termpaint_color_entry *next = entry->next_dirty;
-            entry->dirty = false;
-            entry->next_dirty = nullptr;
-            if (entry->requested.len) {
-                int_puts(integration, "\033]");
-                int_uputs(integration, entry->base.text);
-                int_puts(integration, ";");
-                int_uputs(integration, entry->requested.data);
-                int_puts(integration, termpaintp_terminal_correct_string_terminator(term));
-            } else {
-                int_uputs(integration, entry->restore.data);
-            }
-            entry = next;
+    termpaintp_terminal_flush_colors(term);
+    int_puts(term, "\033[m");
+    if (synchronized) {
+        int_puts(term, "\033[?2026l");
+    }
+    term->primary.styles.gc_blocked--;
+    term->flush_stats_bytes = nullptr;
+    const int64_t paint_done_time = termpaintp_terminal_clock_ns(term);
+    int_flush(term);
+    if (term->integration_vtbl->monotonic_clock_ns) {
+        stats->paint_time_ns = paint_done_time - start_time;
+        stats->write_time_ns = termpaintp_terminal_clock_ns(term) - paint_done_time;
+    }
+    if (term->flush_stats_cb) {
+        term->flush_stats_cb(term->flush_stats_user_data, stats);
+    }
+}
+
+// Number of flushes without a limited output rate before degraded output is restored to full fidelity.
+#define TERMPAINTP_LOW_BANDWIDTH_RECOVER_FLUSHES 8
+
+static void termpaintp_terminal_update_low_bandwidth(termpaint_terminal *term) {
+    const bool limited = term->low_bandwidth_threshold && term->output_rate
+            && term->output_rate < term->low_bandwidth_threshold;
+    if (limited) {
+        term->low_bandwidth_recover_count = 0;
+        if (!term->low_bandwidth) {
+            term->low_bandwidth = true;
+            termpaintp_update_cache_from_capabilities(term);
+        }
+    } else if (term->low_bandwidth) {
+        // avoid switching back and forth when the reduced output just fits the available bandwidth
+        if (!term->low_bandwidth_threshold
+                || ++term->low_bandwidth_recover_count >= TERMPAINTP_LOW_BANDWIDTH_RECOVER_FLUSHES) {
+            term->low_bandwidth = false;
+            term->low_bandwidth_recover_count = 0;
+            termpaintp_update_cache_from_capabilities(term);
         }
     }
-    int_puts(integration, "\033[m");
-    int_flush(integration);
+}
+
+void termpaint_terminal_flush(termpaint_terminal *term, bool full_repaint) {
+    termpaintp_terminal_update_low_bandwidth(term);
+    full_repaint |= term->force_full_repaint;
+    term->force_full_repaint = false;
+    termpaintp_terminal_flush_region(term, full_repaint, term->double_buffered,
+                                     0, 0, term->primary.width, term->primary.height);
+}
+
+void termpaint_terminal_flush_to_buffer(termpaint_terminal *term, bool full_repaint, const char **data, size_t *len) {
+    term->captured_output.len = 0;
+    term->capture_output = true;
+    termpaint_terminal_flush(term, full_repaint);
+    term->capture_output = false;
+    *data = term->captured_output.data ? (const char*)term->captured_output.data : "";
+    *len = term->captured_output.len;
+}
+
+void termpaint_terminal_flush_rect(termpaint_terminal *term, int x, int y, int width, int height) {
+    if (x < 0) {
+        width += x;
+        x = 0;
+    }
+    if (y < 0) {
+        height += y;
+        y = 0;
+    }
+    if (x >= term->primary.width || y >= term->primary.height || width <= 0 || height <= 0) {
+        termpaint_terminal_flush_cursor(term);
+        return;
+    }
+    if (x + width > term->primary.width) {
+        width = term->primary.width - x;
+    }
+    if (y + height > term->primary.height) {
+        height = term->primary.height - y;
+    }
+    termpaintp_terminal_update_low_bandwidth(term);
+    // a pending full repaint is only done for the region, the rest of the surface still needs it.
+    termpaintp_terminal_flush_region(term, term->force_full_repaint, false, x, y, x + width, y + height);
+}
+
+const termpaint_flush_stats *termpaint_terminal_flush_stats(const termpaint_terminal *term) {
+    return &term->flush_stats;
+}
+
+void termpaint_terminal_set_flush_stats_cb(termpaint_terminal *term, void (*cb)(void *user_data, const termpaint_flush_stats *stats), void *user_data) {
+    term->flush_stats_cb = cb;
+    term->flush_stats_user_data = user_data;
+}
+
+void termpaint_terminal_set_double_buffered(termpaint_terminal *term, bool enabled) {
+    if (enabled && !term->double_buffered && term->primary.cells_allocated) {
+        // cells_last_flush needs to be a valid surface in double buffered mode
+        memcpy(term->primary.cells_last_flush, term->primary.cells, term->primary.cells_allocated * sizeof(cell));
+        term->force_full_repaint = true;
+    }
+    term->double_buffered = enabled;
+}
+
+void termpaint_terminal_set_output_rate(termpaint_terminal *term, int bytes_per_second) {
+    term->output_rate = bytes_per_second > 0 ? bytes_per_second : 0;
+}
+
+void termpaint_terminal_set_low_bandwidth_threshold(termpaint_terminal *term, int bytes_per_second) {
+    term->low_bandwidth_threshold = bytes_per_second > 0 ? bytes_per_second : 0;
+}
+
+bool termpaint_terminal_is_low_bandwidth(const termpaint_terminal *term) {
+    return term->low_bandwidth;
+}
+
+void termpaint_terminal_flush_cursor(termpaint_terminal *term) {
+    int_begin_buffering(term);
+    if (term->cursor_x != -1 && term->cursor_y != -1) {
+        termpaintp_terminal_set_cursor(term, term->cursor_x, term->cursor_y);
+    }
+    termpaintp_terminal_update_cursor_style(term);
+    if (term->cursor_visible) {
+        termpaintp_terminal_show_cursor(term);
+    } else {
+        termpaintp_terminal_hide_cursor(term);
+    }
+    termpaintp_terminal_flush_colors(term);
+    int_flush(term);
 }
 
 void termpaint_terminal_set_cursor_position(termpaint_terminal *term, int x, int y) {
@@ -2762,16 +4283,15 @@ bool termpaint_terminal_set_color_mustcheck(termpaint_terminal *term, int color_
             entry->save_state = termpaint_save_state_ready;
             termpaintp_terminal_dirty_color_entry(term, entry);
         } else {
-            termpaint_integration *integration = term->integration;
-            int_puts(integration, "\033]");
-            int_put_num(integration, color_slot);
+            int_puts(term, "\033]");
+            int_put_num(term, color_slot);
             if (termpaint_terminal_capable(term, TERMPAINT_CAPABILITY_7BIT_ST)) {
-                int_puts(integration, ";?\033\\");
+                int_puts(term, ";?\033\\");
             } else {
-                int_puts(integration, ";?\a");
+                int_puts(term, ";?\a");
             }
-            int_awaiting_response(integration);
-            int_flush(integration);
+            int_awaiting_response(term);
+            int_flush(term);
         }
     }
 
@@ -2909,6 +4429,13 @@ static void termpaintp_auto_detect_init_terminal_version_and_caps(termpaint_term
         termpaint_terminal_promise_capability(term, TERMPAINT_CAPABILITY_MAY_TRY_CURSOR_SHAPE);
     }
 
+    if (term->terminal_type != TT_MISPARSING && term->terminal_type != TT_TOODUMB
+            && term->terminal_type != TT_INCOMPATIBLE && term->terminal_type != TT_UNKNOWN) {
+        // Scrolling margins (DECSTBM) and insert/delete line date back to the VT100/VT102. Every terminal that
+        // passes fingerprinting supports these.
+        termpaint_terminal_promise_capability(term, TERMPAINT_CAPABILITY_SCROLL_REGION);
+    }
+
     if (term->terminal_type == TT_MISPARSING) {
         termpaint_terminal_disable_capability(term, TERMPAINT_CAPABILITY_EXTENDED_CHARSET);
     } else if (term->terminal_type == TT_TOODUMB) {
@@ -3125,6 +4652,7 @@ static void termpaintp_auto_detect_init_terminal_version_and_caps(termpaint_term
         termpaint_terminal_promise_capability(term, TERMPAINT_CAPABILITY_MAY_TRY_TAGGED_PASTE);
         termpaint_terminal_promise_capability(term, TERMPAINT_CAPABILITY_TRUECOLOR_SUPPORTED);
         term->max_csi_parameters = 10;
+        termpaintp_terminal_invalidate_sgr_cache(term);
     } else if (term->terminal_type == TT_MSFT_TERMINAL) {
         termpaint_terminal_promise_capability(term, TERMPAINT_CAPABILITY_TRUECOLOR_SUPPORTED);
     } else if (term->terminal_type == TT_FULL) {
@@ -3186,7 +4714,7 @@ static void termpaintp_input_event_callback(void *user_data, termpaint_event *ev
         term->event_cb(term->event_user_data, event);
     } else {
         termpaintp_terminal_auto_detect_event(term, event);
-        int_flush(term->integration);
+        int_flush(term);
         if (term->ad_state == AD_FINISHED) {
             termpaintp_auto_detect_init_terminal_version_and_caps(term);
 
@@ -3202,10 +4730,9 @@ static void termpaintp_input_event_callback(void *user_data, termpaint_event *ev
 void termpaint_terminal_callback(termpaint_terminal *term) {
     if (term->data_pending_after_input_received) {
         term->data_pending_after_input_received = false;
-        termpaint_integration *integration = term->integration;
-        int_puts(integration, "\033[5n");
-        int_awaiting_response(integration);
-        int_flush(integration);
+        int_puts(term, "\033[5n");
+        int_awaiting_response(term);
+        int_flush(term);
     }
 }
 
@@ -3277,8 +4804,7 @@ void termpaint_terminal_activate_input_quirk(termpaint_terminal *term, int quirk
     termpaint_input_activate_quirk(term->input, quirk);
 }
 
-static void termpaintp_patch_misparsing_defered(termpaint_terminal *terminal, termpaint_integration *integration,
-                                        auto_detect_state next_state) {
+static void termpaintp_patch_misparsing_defered(termpaint_terminal *terminal, auto_detect_state next_state) {
     terminal->ad_state = AD_GLITCH_PATCHING;
     terminal->glitch_patching_next_state = next_state;
 
@@ -3292,31 +4818,30 @@ static void termpaintp_patch_misparsing_defered(termpaint_terminal *terminal, te
         reset_y -= 1;
     }
 
-    int_puts(integration, "\033[");
-    int_put_num(integration, reset_y + 1);
-    int_puts(integration, ";");
-    int_put_num(integration, reset_x + 1);
-    int_puts(integration, "H");
-    int_puts(integration, " ");
+    int_puts(terminal, "\033[");
+    int_put_num(terminal, reset_y + 1);
+    int_puts(terminal, ";");
+    int_put_num(terminal, reset_x + 1);
+    int_puts(terminal, "H");
+    int_puts(terminal, " ");
     if (termpaint_terminal_capable(terminal, TERMPAINT_CAPABILITY_SAFE_POSITION_REPORT)) {
-        int_puts(integration, "\033[?6n");
+        int_puts(terminal, "\033[?6n");
     } else {
-        int_puts(integration, "\033[6n");
+        int_puts(terminal, "\033[6n");
         termpaint_terminal_expect_cursor_position_report(terminal);
     }
 }
 
-static void termpaintp_patch_misparsing_from_event(termpaint_terminal *terminal, termpaint_integration *integration,
+static void termpaintp_patch_misparsing_from_event(termpaint_terminal *terminal,
                                         termpaint_event *event, auto_detect_state next_state) {
     terminal->glitch_cursor_x = event->cursor_position.x;
     terminal->glitch_cursor_y = event->cursor_position.y;
-    termpaintp_patch_misparsing_defered(terminal, integration, next_state);
+    termpaintp_patch_misparsing_defered(terminal, next_state);
 }
 
 static void termpaintp_terminal_auto_detect_prepare_self_reporting(termpaint_terminal *terminal, int new_state) {
-    termpaint_integration *integration = terminal->integration;
 
-    int_puts(integration, "\033[>q");
+    int_puts(terminal, "\033[>q");
     bool might_be_kitty = false;
     bool might_be_iterm2 = false;
     bool might_be_mlterm = false;
@@ -3346,16 +4871,22 @@ static void termpaintp_terminal_auto_detect_prepare_self_reporting(termpaint_ter
                            && memcmp(terminal->auto_detect_sec_device_attributes.data, "\033[>24;279;0c", 10) == 0);
     }
     if (might_be_kitty || might_be_iterm2 || might_be_mlterm) {
-        int_puts(integration, "\033P+q544e\033\\");
+        int_puts(terminal, "\033P+q544e\033\\");
+    }
+    if (terminal->terminal_type == TT_FULL || terminal->terminal_type == TT_XTERM
+            || terminal->terminal_type == TT_MINTTY || terminal->terminal_type == TT_MSFT_TERMINAL
+            || might_be_kitty || might_be_iterm2) {
+        // DECRQM for synchronized output. Only sent to terminals that are known to parse
+        // DECRQM correctly, others might leave a visible trace of the sequence.
+        int_puts(terminal, "\033[?2026$p");
     }
-    int_puts(integration, "\033[5n");
-    int_awaiting_response(integration);
+    int_puts(terminal, "\033[5n");
+    int_awaiting_response(terminal);
     terminal->ad_state = new_state;
 }
 
 // known terminals where auto detections hangs: freebsd system console using vt module
 static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal, termpaint_event *event) {
-    termpaint_integration *integration = terminal->integration;
 
     if (event == nullptr) {
         terminal->ad_state = AD_INITIAL;
@@ -3378,12 +4909,12 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
             terminal->glitch_cursor_y = -1; // disarmed glitch patching state
             termpaint_input_expect_cursor_position_report(terminal->input);
             termpaint_input_expect_cursor_position_report(terminal->input);
-            int_puts(integration, "\033[5n");
-            int_puts(integration, "\033[6n");
-            int_puts(integration, "\033[>c");
-            int_puts(integration, "\033[6n");
-            int_puts(integration, "\033[5n");
-            int_awaiting_response(integration);
+            int_puts(terminal, "\033[5n");
+            int_puts(terminal, "\033[6n");
+            int_puts(terminal, "\033[>c");
+            int_puts(terminal, "\033[6n");
+            int_puts(terminal, "\033[5n");
+            int_awaiting_response(terminal);
             terminal->ad_state = AD_BASICCOMPAT;
             return true;
         case AD_BASICCOMPAT:
@@ -3490,7 +5021,7 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
             break;
         case AD_BASIC_NO_SEC_DEV_ATTRIB_MISPARSING:
             if (event->type == TERMPAINT_EV_MISC && event->misc.atom == termpaint_input_i_resync()) {
-                termpaintp_patch_misparsing_defered(terminal, integration, AD_FINISHED);
+                termpaintp_patch_misparsing_defered(terminal, AD_FINISHED);
                 return true;
             }
             break;
@@ -3498,12 +5029,12 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
             if (event->type == TERMPAINT_EV_MISC && event->misc.atom == termpaint_input_i_resync()) {
                 termpaint_terminal_promise_capability(terminal, TERMPAINT_CAPABILITY_CSI_GREATER);
 
-                int_puts(integration, "\033[=c");
-                int_puts(integration, "\033[>1c");
-                int_puts(integration, "\033[?6n");
-                int_puts(integration, "\033[1x");
-                int_puts(integration, "\033[5n");
-                int_awaiting_response(integration);
+                int_puts(terminal, "\033[=c");
+                int_puts(terminal, "\033[>1c");
+                int_puts(terminal, "\033[?6n");
+                int_puts(terminal, "\033[1x");
+                int_puts(terminal, "\033[5n");
+                int_awaiting_response(terminal);
                 terminal->ad_state = AD_FP1_REQ;
                 return true;
             }
@@ -3522,8 +5053,8 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
                         termpaint_terminal_promise_capability(terminal, TERMPAINT_CAPABILITY_88_COLOR);
                         // Using BEL as termination, because urxvt doesn't properly support ESC \ as terminator
                         // at least till 9.22 urxvt sends just ESC as terminator when using ESC \ in the request.
-                        int_puts(integration, "\033]4;255;?\007");
-                        int_puts(integration, "\033[5n");
+                        int_puts(terminal, "\033]4;255;?\007");
+                        int_puts(terminal, "\033[5n");
                         terminal->ad_state = AD_URXVT_88_256_REQ;
                         return true;
                     } else {
@@ -3531,12 +5062,12 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
                         return true;
                     }
                 }
-                int_puts(integration, "\033[=c");
-                int_puts(integration, "\033[>1c");
-                int_puts(integration, "\033[?6n");
-                int_puts(integration, "\033[1x");
-                int_puts(integration, "\033[5n");
-                int_awaiting_response(integration);
+                int_puts(terminal, "\033[=c");
+                int_puts(terminal, "\033[>1c");
+                int_puts(terminal, "\033[?6n");
+                int_puts(terminal, "\033[1x");
+                int_puts(terminal, "\033[5n");
+                int_awaiting_response(terminal);
                 terminal->ad_state = AD_FP1_REQ;
                 return true;
             }
@@ -3558,8 +5089,8 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
                 termpaint_terminal_disable_capability(terminal, TERMPAINT_CAPABILITY_SAFE_POSITION_REPORT);
                 // see if "\033[=c" was misparsed
                 termpaint_input_expect_cursor_position_report(terminal->input);
-                int_puts(integration, "\033[6n");
-                int_awaiting_response(integration);
+                int_puts(terminal, "\033[6n");
+                int_awaiting_response(terminal);
                 terminal->ad_state = AD_FP1_CLEANUP;
                 return true;
             } else if (event->type == TERMPAINT_EV_RAW_3RD_DEV_ATTRIB) {
@@ -3685,7 +5216,7 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
             if (event->type == TERMPAINT_EV_CURSOR_POSITION) {
                 if (terminal->initial_cursor_y != event->cursor_position.y
                      || terminal->initial_cursor_x != event->cursor_position.x) {
-                    termpaintp_patch_misparsing_from_event(terminal, integration, event, AD_FINISHED);
+                    termpaintp_patch_misparsing_from_event(terminal, event, AD_FINISHED);
                     return true;
                 } else {
                     termpaint_terminal_promise_capability(terminal, TERMPAINT_CAPABILITY_CSI_EQUALS);
@@ -3704,12 +5235,12 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
             if (event->type == TERMPAINT_EV_MISC && event->misc.atom == termpaint_input_i_resync()) {
                 // see if "\033[=c" was misparsed
                 if (termpaint_terminal_capable(terminal, TERMPAINT_CAPABILITY_SAFE_POSITION_REPORT)) {
-                    int_puts(integration, "\033[?6n");
+                    int_puts(terminal, "\033[?6n");
                 } else {
                     termpaint_input_expect_cursor_position_report(terminal->input);
-                    int_puts(integration, "\033[6n");
+                    int_puts(terminal, "\033[6n");
                 }
-                int_awaiting_response(integration);
+                int_awaiting_response(terminal);
                 terminal->ad_state = AD_FP1_CLEANUP;
                 return true;
             }
@@ -3763,6 +5294,14 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
                     }
                 }
                 return true;
+            } else if (event->type == TERMPAINT_EV_MODE_REPORT) {
+                terminal->ad_state = AD_SELF_REPORTING;
+                // status 1 (set), 2 (reset) and 3 (permanently set) all mean the mode is recognized
+                if (event->mode.kind == 1 && event->mode.number == 2026
+                        && event->mode.status >= 1 && event->mode.status <= 3) {
+                    termpaint_terminal_promise_capability(terminal, TERMPAINT_CAPABILITY_SYNCHRONIZED_OUTPUT);
+                }
+                return true;
             }
             break;
         case AD_WAIT_FOR_SYNC_TO_FINISH:
@@ -3822,10 +5361,10 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
             if (event->type == TERMPAINT_EV_MISC && event->misc.atom == termpaint_input_i_resync()) {
                 termpaint_terminal_disable_capability(terminal, TERMPAINT_CAPABILITY_SAFE_POSITION_REPORT);
                 termpaint_input_expect_cursor_position_report(terminal->input);
-                int_puts(integration, "\033[6n"); // detect if "\033[=c" was misparsed
-                int_puts(integration, "\033[>0;1c");
-                int_puts(integration, "\033[5n");
-                int_awaiting_response(integration);
+                int_puts(terminal, "\033[6n"); // detect if "\033[=c" was misparsed
+                int_puts(terminal, "\033[>0;1c");
+                int_puts(terminal, "\033[5n");
+                int_awaiting_response(terminal);
                 terminal->ad_state = AD_FP2_REQ;
                 return true;
             } else if (event->type == TERMPAINT_EV_CURSOR_POSITION) {
@@ -3853,7 +5392,7 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
         case AD_FP1_QMCURSOR_POS_RECVED:
             if (event->type == TERMPAINT_EV_MISC && event->misc.atom == termpaint_input_i_resync()) {
                 if (terminal->glitch_cursor_y != -1) {
-                    termpaintp_patch_misparsing_defered(terminal, integration, AD_FINISHED);
+                    termpaintp_patch_misparsing_defered(terminal, AD_FINISHED);
                     return true;
                 } else {
                     termpaintp_terminal_auto_detect_prepare_self_reporting(terminal, AD_SELF_REPORTING);
@@ -3872,9 +5411,9 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
             break;
         case AD_FP1_SEC_DEV_ATTRIB_QMCURSOR_POS_RECVED:
             if (event->type == TERMPAINT_EV_MISC && event->misc.atom == termpaint_input_i_resync()) {
-                int_puts(integration, "\033[>0;1c");
-                int_puts(integration, "\033[5n");
-                int_awaiting_response(integration);
+                int_puts(terminal, "\033[>0;1c");
+                int_puts(terminal, "\033[5n");
+                int_awaiting_response(terminal);
                 terminal->ad_state = AD_FP2_CURSOR_DONE;
                 return true;
             } else if (event->type == TERMPAINT_EV_RAW_DECREQTPARM) {
@@ -3914,7 +5453,7 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
                     termpaintp_terminal_auto_detect_prepare_self_reporting(terminal, AD_SELF_REPORTING);
                     return true;
                 } else {
-                    termpaintp_patch_misparsing_defered(terminal, integration, AD_FINISHED);
+                    termpaintp_patch_misparsing_defered(terminal, AD_FINISHED);
                     return true;
                 }
             } else if (event->type == TERMPAINT_EV_RAW_SEC_DEV_ATTRIB) {
@@ -3931,7 +5470,7 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
                     termpaintp_terminal_auto_detect_prepare_self_reporting(terminal, AD_SELF_REPORTING);
                     return true;
                 } else {
-                    termpaintp_patch_misparsing_defered(terminal, integration, AD_FINISHED);
+                    termpaintp_patch_misparsing_defered(terminal, AD_FINISHED);
                     return true;
                 }
             } else if (event->type == TERMPAINT_EV_RAW_SEC_DEV_ATTRIB) {
@@ -3950,7 +5489,7 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
                     termpaintp_terminal_auto_detect_prepare_self_reporting(terminal, AD_SELF_REPORTING);
                     return true;
                 } else {
-                    termpaintp_patch_misparsing_defered(terminal, integration, AD_FINISHED);
+                    termpaintp_patch_misparsing_defered(terminal, AD_FINISHED);
                     return true;
                 }
             }
@@ -3961,10 +5500,10 @@ static bool termpaintp_terminal_auto_detect_event(termpaint_terminal *terminal,
                 if ((event->cursor_position.y < terminal->glitch_cursor_y)
                         || ((event->cursor_position.y == terminal->glitch_cursor_y) && (event->cursor_position.x < terminal->glitch_cursor_x))) {
                     if (termpaint_terminal_capable(terminal, TERMPAINT_CAPABILITY_SAFE_POSITION_REPORT)) {
-                        int_puts(integration, " \033[?6n");
+                        int_puts(terminal, " \033[?6n");
                     } else {
                         termpaint_input_expect_cursor_position_report(terminal->input);
-                        int_puts(integration, " \033[6n");
+                        int_puts(terminal, " \033[6n");
                     }
                     return true;
                 } else {
@@ -4025,7 +5564,7 @@ _Bool termpaint_terminal_auto_detect(termpaint_terminal *terminal) {
     termpaintp_terminal_reset_capabilites(terminal);
 
     termpaintp_terminal_auto_detect_event(terminal, nullptr);
-    int_flush(terminal->integration);
+    int_flush(terminal);
     return true;
 }
 
@@ -4139,7 +5678,6 @@ static bool termpaintp_has_option(const char *options, const char *name) {
 }
 
 void termpaint_terminal_setup_fullscreen(termpaint_terminal *terminal, int width, int height, const char *options) {
-    termpaint_integration *integration = terminal->integration;
 
     termpaint_str *init_sequence = &terminal->unpause_basic_setup;
 
@@ -4161,8 +5699,8 @@ void termpaint_terminal_setup_fullscreen(termpaint_terminal *terminal, int width
         termpaintp_prepend_str(&terminal->restore_seq, (const uchar*)"\033[>4m");
         termpaintp_str_append(init_sequence, "\033[>4;2m");
     }
-    int_put_tps(integration, init_sequence);
-    int_flush(integration);
+    int_put_tps(terminal, init_sequence);
+    int_flush(terminal);
     int_restore_sequence_updated(terminal);
 
     termpaint_surface_resize(&terminal->primary, width, height);
@@ -4173,59 +5711,53 @@ const char* termpaint_terminal_restore_sequence(const termpaint_terminal *term)
 }
 
 void termpaint_terminal_pause(termpaint_terminal *term) {
-    termpaint_integration *integration = term->integration;
 
     if (term->restore_seq.len) {
-        int_write(integration, (const char*)term->restore_seq.data, term->restore_seq.len);
+        int_write(term, (const char*)term->restore_seq.data, term->restore_seq.len);
     }
-    int_flush(integration);
+    int_flush(term);
 }
 
 void termpaint_terminal_unpause(termpaint_terminal *term) {
     term->cursor_prev_data = -2;
-    termpaint_integration *integration = term->integration;
 
     // reconstruct state after setup_fullscreen
-    int_put_tps(integration, &term->unpause_basic_setup);
+    int_put_tps(term, &term->unpause_basic_setup);
 
     // save/push sequences
     if (term->did_terminal_push_title) {
-        int_puts(integration, "\033[22t");
+        int_puts(term, "\033[22t");
     }
 
     // other did_* sequences
     if (term->did_terminal_enable_mouse) {
-        int_puts(integration, "\033[?1015h\033[?1006h");
+        int_puts(term, "\033[?1015h\033[?1006h");
     }
 
     // the rest
     for (int i = 0; i < term->colors.allocated; i++) {
-        termpaint_color_entry* item_it = (termpaint_color_entry*)term->colors.buckets[i];
-        while (item_it) {
-            if (item_it->save_state == termpaint_save_state_ready) {
-                if (item_it->requested.len) {
-                    int_puts(integration, "\033]");
-                    int_uputs(integration, item_it->base.text);
-                    int_puts(integration, ";");
-                    int_uputs(integration, item_it->requested.data);
-                    int_puts(integration, termpaintp_terminal_correct_string_terminator(term));
-                } else {
-                    int_uputs(integration, item_it->restore.data);
-                }
+        termpaint_color_entry* item_it = (termpaint_color_entry*)term->colors.slots[i].item;
+        if (item_it && item_it->save_state == termpaint_save_state_ready) {
+            if (item_it->requested.len) {
+                int_puts(term, "\033]");
+                int_uputs(term, item_it->base.text);
+                int_puts(term, ";");
+                int_uputs(term, item_it->requested.data);
+                int_puts(term, termpaintp_terminal_correct_string_terminator(term));
+            } else {
+                int_uputs(term, item_it->restore.data);
             }
-            item_it = (termpaint_color_entry*)item_it->base.next;
         }
     }
 
     for (int i = 0; i < term->unpause_snippets.allocated; i++) {
-        termpaint_unpause_snippet* item_it = (termpaint_unpause_snippet*)term->unpause_snippets.buckets[i];
-        while (item_it) {
-            int_put_tps(integration, &item_it->sequences);
-            item_it = (termpaint_unpause_snippet*)item_it->base.next;
+        termpaint_unpause_snippet* item_it = (termpaint_unpause_snippet*)term->unpause_snippets.slots[i].item;
+        if (item_it) {
+            int_put_tps(term, &item_it->sequences);
         }
     }
 
-    int_flush(integration);
+    int_flush(term);
 }
 
 static termpaint_str* termpaintp_terminal_get_unpause_slot(termpaint_terminal *term, const char *name) {
@@ -4727,12 +6259,11 @@ bool termpaint_terminal_set_title_mustcheck(termpaint_terminal *term, const char
         }
     }
 
-    termpaint_integration *integration = term->integration;
 
     if (!term->did_terminal_push_title) {
         termpaintp_prepend_str(&term->restore_seq, (const uchar*)"\033[23t");
         int_restore_sequence_updated(term);
-        int_puts(integration, "\033[22t");
+        int_puts(term, "\033[22t");
         term->did_terminal_push_title = true;
     }
 
@@ -4747,8 +6278,8 @@ bool termpaint_terminal_set_title_mustcheck(termpaint_terminal *term, const char
     if (!sequences->len) {
         return false;
     }
-    int_put_tps(integration, sequences);
-    int_flush(integration);
+    int_put_tps(term, sequences);
+    int_flush(term);
     return true;
 }
 
@@ -4765,12 +6296,11 @@ bool termpaint_terminal_set_icon_title_mustcheck(termpaint_terminal *term, const
         }
     }
 
-    termpaint_integration *integration = term->integration;
 
     if (!term->did_terminal_push_title) {
         termpaintp_prepend_str(&term->restore_seq, (const uchar*)"\033[23t");
         int_restore_sequence_updated(term);
-        int_puts(integration, "\033[22t");
+        int_puts(term, "\033[22t");
         term->did_terminal_push_title = true;
     }
 
@@ -4785,8 +6315,8 @@ bool termpaint_terminal_set_icon_title_mustcheck(termpaint_terminal *term, const
     if (!sequences->len) {
         return false;
     }
-    int_put_tps(integration, sequences);
-    int_flush(integration);
+    int_put_tps(term, sequences);
+    int_flush(term);
     return true;
 }
 
@@ -4797,15 +6327,13 @@ void termpaint_terminal_set_icon_title(termpaint_terminal *term, const char *tit
 }
 
 void termpaint_terminal_bell(termpaint_terminal *term) {
-    termpaint_integration *integration = term->integration;
-    int_puts(integration, "\a");
-    int_flush(integration);
+    int_puts(term, "\a");
+    int_flush(term);
 }
 
 #define DISABLE_MOUSE_SEQUENCE "\033[?1003l\033[?1002l\033[?1000l\033[?1006l\033[?1015l"
 
 _Bool termpaint_terminal_set_mouse_mode_mustcheck(termpaint_terminal *term, int mouse_mode) {
-    termpaint_integration *integration = term->integration;
 
     if (mouse_mode != TERMPAINT_MOUSE_MODE_OFF) {
         if (!term->did_terminal_add_mouse_to_restore) {
@@ -4817,8 +6345,8 @@ _Bool termpaint_terminal_set_mouse_mode_mustcheck(termpaint_terminal *term, int
     } else {
         if (term->did_terminal_enable_mouse) {
             term->did_terminal_enable_mouse = false;
-            int_puts(integration, DISABLE_MOUSE_SEQUENCE);
-            int_flush(integration);
+            int_puts(term, DISABLE_MOUSE_SEQUENCE);
+            int_flush(term);
             termpaint_str* sequences = termpaintp_terminal_get_unpause_slot(term, "mouse");
             if (sequences) {
                 if (!termpaintp_str_assign_mustcheck(sequences, "")) {
@@ -4849,11 +6377,11 @@ _Bool termpaint_terminal_set_mouse_mode_mustcheck(termpaint_terminal *term, int
 
     if (!term->did_terminal_enable_mouse) {
         term->did_terminal_enable_mouse = true;
-        int_puts(integration, "\033[?1015h\033[?1006h");
+        int_puts(term, "\033[?1015h\033[?1006h");
     }
 
-    int_put_tps(integration, sequences);
-    int_flush(integration);
+    int_put_tps(term, sequences);
+    int_flush(term);
     return true;
 }
 
@@ -4870,7 +6398,6 @@ bool termpaint_terminal_request_focus_change_reports_mustcheck(termpaint_termina
          int_restore_sequence_updated(term);
     }
 
-    termpaint_integration *integration = term->integration;
 
     termpaint_str* sequences = termpaintp_terminal_get_unpause_slot(term, "focus report");
     if (!sequences) {
@@ -4886,8 +6413,8 @@ bool termpaint_terminal_request_focus_change_reports_mustcheck(termpaint_termina
             return false;
         }
     }
-    int_put_tps(integration, sequences);
-    int_flush(integration);
+    int_put_tps(term, sequences);
+    int_flush(term);
     return true;
 }
 
@@ -4904,7 +6431,6 @@ bool termpaint_terminal_request_tagged_paste_mustcheck(termpaint_terminal *term,
          int_restore_sequence_updated(term);
     }
 
-    termpaint_integration *integration = term->integration;
 
     termpaint_str* sequences = termpaintp_terminal_get_unpause_slot(term, "bracketed paste");
     if (!sequences) {
@@ -4920,8 +6446,8 @@ bool termpaint_terminal_request_tagged_paste_mustcheck(termpaint_terminal *term,
             return false;
         }
     }
-    int_put_tps(integration, sequences);
-    int_flush(integration);
+    int_put_tps(term, sequences);
+    int_flush(term);
     return true;
 }
 
@@ -5114,11 +6640,94 @@ static bool termpaintp_test_parse_version(void) {
     return ret;
 }
 
+static bool termpaintp_test_quantize_cache(void) {
+    termpaint_terminal terminal;
+    terminal.cache_should_use_truecolor = false;
+    terminal.quantize_cache = nullptr;
+    bool ret = true;
+    for (int mode = 0; mode < 2; mode++) {
+        terminal.capabilities[TERMPAINT_CAPABILITY_88_COLOR] = mode == 1;
+        for (int r = 0; r < 256; r += 3) {
+            for (int g = 0; g < 256; g += 5) {
+                for (int b = 0; b < 256; b += 7) {
+                    // twice, to check both filling and using the cache
+                    for (int i = 0; i < 2; i++) {
+                        uint32_t color = TERMPAINT_RGB_COLOR(r, g, b);
+                        ret &= termpaintp_quantize_color_cached(&terminal, color)
+                                == termpaintp_quantize_color(&terminal, color);
+                    }
+                }
+            }
+        }
+        free(terminal.quantize_cache);
+        terminal.quantize_cache = nullptr;
+    }
+    return ret;
+}
+
+static void termpaintp_test_integration_free(termpaint_integration *integration) {
+    termpaint_integration_deinit(integration);
+}
+
+static void termpaintp_test_integration_write(termpaint_integration *integration, const char *data, int length) {
+    (void)integration; (void)data; (void)length;
+}
+
+static void termpaintp_test_integration_flush(termpaint_integration *integration) {
+    (void)integration;
+}
+
+static void termpaintp_test_put_2byte_utf8(unsigned char *buffer, int codepoint) {
+    buffer[0] = 0xc0 | (codepoint >> 6);
+    buffer[1] = 0x80 | (codepoint & 0x3f);
+}
+
+// Writes many distinct long clusters and checks that the incremental collection keeps the overflow text of the
+// surface below 1.5 times the collection trigger (plus the item added by the current call). After a sweep at most the
+// clusters of cells and cells_last_flush remain, so the trigger (twice that count) has to stay below 4 times the
+// number of cells.
+static bool termpaintp_test_overflow_gc_bounded(void) {
+    termpaint_integration integration;
+    termpaint_integration_init(&integration, termpaintp_test_integration_free, termpaintp_test_integration_write,
+                               termpaintp_test_integration_flush);
+    termpaint_terminal *terminal = termpaint_terminal_new(&integration);
+    termpaint_surface *surface = termpaint_terminal_get_surface(terminal);
+    termpaint_surface_resize(surface, 40, 10);
+
+    const int cell_count = 40 * 10;
+    bool ret = true;
+    bool collected = false;
+    for (int round = 0; round < 40; round++) {
+        for (int i = 0; i < 400; i++) {
+            unsigned char text[10];
+            text[0] = 'a' + i % 26;
+            termpaintp_test_put_2byte_utf8(text + 1, 0x300 + round % 112);
+            termpaintp_test_put_2byte_utf8(text + 3, 0x300 + i % 112);
+            termpaintp_test_put_2byte_utf8(text + 5, 0x300 + (i / 112) % 112);
+            termpaintp_test_put_2byte_utf8(text + 7, 0x308);
+            text[9] = 0;
+            termpaint_surface_write_with_colors(surface, i % 40, i / 40, (const char*)text,
+                                                TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+            const int trigger = surface->overflow_gc_trigger;
+            ret &= surface->overflow_text.count <= trigger + trigger / 2 + 1;
+            ret &= trigger <= 4 * cell_count;
+            collected |= trigger > TERMPAINTP_OVERFLOW_GC_MIN_TRIGGER;
+        }
+        termpaint_terminal_flush(terminal, false);
+    }
+    // each round writes 400 new clusters, so collections have to finish and adapt the trigger
+    ret &= collected;
+    termpaint_terminal_free(terminal);
+    return ret;
+}
+
 _tERMPAINT_PUBLIC bool termpaintp_test(void) {
     bool ret = true;
     ret &= termpaintp_test_quantize_to_256();
     ret &= termpaintp_test_quantize_to_88();
+    ret &= termpaintp_test_quantize_cache();
     ret &= termpaintp_test_parse_version();
+    ret &= termpaintp_test_overflow_gc_bounded();
     ret &= termpaintp_mem_ascii_case_insensitive_equals("A", "a", 1);
     ret &= !termpaintp_mem_ascii_case_insensitive_equals("[", "{", 1);
     return ret;
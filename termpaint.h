@@ -2,6 +2,7 @@
 #ifndef TERMPAINT_TERMPAINT_INCLUDED
 #define TERMPAINT_TERMPAINT_INCLUDED
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <termpaint_event.h>
@@ -54,6 +55,7 @@ _tERMPAINT_PUBLIC void termpaint_integration_set_request_callback(termpaint_inte
 _tERMPAINT_PUBLIC void termpaint_integration_set_awaiting_response(termpaint_integration *integration, void (*awaiting_response)(termpaint_integration *integration));
 _tERMPAINT_PUBLIC void termpaint_integration_set_restore_sequence_updated(termpaint_integration *integration, void (*restore_sequence_updated)(termpaint_integration *integration, const char *data, int length));
 _tERMPAINT_PUBLIC void termpaint_integration_set_logging_func(termpaint_integration *integration, void (*logging_func)(termpaint_integration *integration, const char *data, int length));
+_tERMPAINT_PUBLIC void termpaint_integration_set_monotonic_clock_ns(termpaint_integration *integration, int64_t (*monotonic_clock_ns)(termpaint_integration *integration));
 
 // getters go here if need arises
 
@@ -63,6 +65,30 @@ _tERMPAINT_PUBLIC void termpaint_terminal_free(termpaint_terminal *term);
 _tERMPAINT_PUBLIC void termpaint_terminal_free_with_restore(termpaint_terminal *term);
 _tERMPAINT_PUBLIC termpaint_surface *termpaint_terminal_get_surface(termpaint_terminal *term);
 _tERMPAINT_PUBLIC void termpaint_terminal_flush(termpaint_terminal *term, _Bool full_repaint);
+_tERMPAINT_PUBLIC void termpaint_terminal_flush_to_buffer(termpaint_terminal *term, _Bool full_repaint, const char **data, size_t *len);
+_tERMPAINT_PUBLIC void termpaint_terminal_flush_rect(termpaint_terminal *term, int x, int y, int width, int height);
+_tERMPAINT_PUBLIC void termpaint_terminal_flush_cursor(termpaint_terminal *term);
+_tERMPAINT_PUBLIC void termpaint_terminal_set_double_buffered(termpaint_terminal *term, _Bool enabled);
+_tERMPAINT_PUBLIC void termpaint_terminal_set_output_rate(termpaint_terminal *term, int bytes_per_second);
+_tERMPAINT_PUBLIC void termpaint_terminal_set_low_bandwidth_threshold(termpaint_terminal *term, int bytes_per_second);
+_tERMPAINT_PUBLIC _Bool termpaint_terminal_is_low_bandwidth(const termpaint_terminal *term);
+
+typedef struct termpaint_flush_stats_ {
+    int cells_scanned;
+    int cells_painted;
+    int rows_skipped;
+    int attribute_changes;
+    int cursor_moves;
+    int bytes_text;
+    int bytes_sgr;
+    int bytes_movement;
+    int bytes_misc;
+    int64_t paint_time_ns;
+    int64_t write_time_ns;
+} termpaint_flush_stats;
+
+_tERMPAINT_PUBLIC const termpaint_flush_stats *termpaint_terminal_flush_stats(const termpaint_terminal *term);
+_tERMPAINT_PUBLIC void termpaint_terminal_set_flush_stats_cb(termpaint_terminal *term, void (*cb)(void *user_data, const termpaint_flush_stats *stats), void *user_data);
 _tERMPAINT_PUBLIC const char *termpaint_terminal_restore_sequence(const termpaint_terminal *term);
 _tERMPAINT_PUBLIC void termpaint_terminal_set_cursor_position(termpaint_terminal *term, int x, int y);
 _tERMPAINT_PUBLIC void termpaint_terminal_set_cursor_visible(termpaint_terminal *term, _Bool visible);
@@ -145,6 +171,10 @@ _tERMPAINT_PUBLIC void termpaint_terminal_setup_fullscreen(termpaint_terminal *t
 #define TERMPAINT_CAPABILITY_7BIT_ST 12
 #define TERMPAINT_CAPABILITY_MAY_TRY_CURSOR_SHAPE 13
 #define TERMPAINT_CAPABILITY_MAY_TRY_TAGGED_PASTE 14
+#define TERMPAINT_CAPABILITY_SCROLL_REGION 15
+#define TERMPAINT_CAPABILITY_SYNCHRONIZED_OUTPUT 16
+#define TERMPAINT_CAPABILITY_REPEAT_CHAR 17
+#define TERMPAINT_CAPABILITY_ERASE_CHAR 18
 
 _tERMPAINT_PUBLIC _Bool termpaint_terminal_capable(const termpaint_terminal *terminal, int capability);
 _tERMPAINT_PUBLIC void termpaint_terminal_promise_capability(termpaint_terminal *terminal, int capability);
@@ -159,6 +189,7 @@ _tERMPAINT_PUBLIC void termpaint_terminal_unpause(termpaint_terminal *term);
 
 _tERMPAINT_PUBLIC void termpaint_terminal_set_log_mask(termpaint_terminal *term, unsigned mask);
 _tERMPAINT_PUBLIC void termpaint_terminal_glitch_on_out_of_memory(termpaint_terminal *term);
+_tERMPAINT_PUBLIC void termpaint_terminal_set_output_buffer_size(termpaint_terminal *term, int size);
 
 _tERMPAINT_PUBLIC termpaint_attr* termpaint_attr_new(unsigned fg, unsigned bg);
 _tERMPAINT_PUBLIC termpaint_attr* termpaint_attr_new_or_nullptr(unsigned fg, unsigned bg);
@@ -37,6 +37,20 @@ static inline _Bool termpaint_sadd_overflow(int a, int b, int* res) {
 #endif
 }
 
+// Index of the lowest set bit, value must not be 0.
+static inline int termpaint_ctz64(unsigned long long value) {
+#ifdef __GNUC__
+    return __builtin_ctzll(value);
+#else
+    int index = 0;
+    while (!(value & 1)) {
+        value >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
 #define UNUSED(x) (void)x
 
 #ifdef __GNUC__
@@ -2,6 +2,7 @@
 #ifndef TERMPAINT_TERMPAINT_HASH_INCLUDED
 #define TERMPAINT_TERMPAINT_HASH_INCLUDED
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,126 +13,131 @@
 typedef struct termpaint_hash_item_ {
     unsigned char* text;
     bool unused;
-    struct termpaint_hash_item_ *next;
 } termpaint_hash_item;
 
+// The index uses open addressing with linear probing. Items are allocated separately, so pointers to them stay
+// valid when the index is resized.
+typedef struct termpaint_hash_slot_ {
+    uint32_t hash;
+    termpaint_hash_item* item; // NULL for empty slots
+} termpaint_hash_slot;
+
+#define TERMPAINTP_HASH_SLAB_SIZE 4096
+#define TERMPAINTP_HASH_SLAB_GRANULE 16
+#define TERMPAINTP_HASH_SLAB_CLASSES 8
+
+typedef struct termpaint_hash_slab_ {
+    struct termpaint_hash_slab_ *next;
+} termpaint_hash_slab;
+
 typedef struct termpaint_hash_ {
     int count;
-    int allocated;
-    termpaint_hash_item** buckets;
+    int allocated; // number of slots, always a power of two
+    termpaint_hash_slot* slots;
     int item_size;
     void (*gc_mark_cb)(struct termpaint_hash_*);
     void (*destroy_cb)(struct termpaint_hash_item_*);
+
+    // If set, items are stored together with their text in blocks carved from larger slabs owned by the hash.
+    // Freed blocks are kept in a free list per size and all slabs are released at once.
+    bool use_slab;
+    termpaint_hash_slab* slabs;
+    unsigned char* slab_pos;
+    unsigned char* slab_end;
+    void* slab_free[TERMPAINTP_HASH_SLAB_CLASSES];
 } termpaint_hash;
 
 
-static uint32_t termpaintp_hash_fnv1a(const unsigned char* text) {
-    uint32_t hash = 2166136261;
-    for (; *text; ++text) {
-            hash = hash ^ *text;
-            hash = hash * 16777619;
+// Hashes 8 bytes at a time, the hash only needs to be consistent within one process.
+static uint32_t termpaintp_hash_string(const unsigned char* text) {
+    size_t len = strlen((const char*)text);
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ len;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, text, 8);
+        hash = (hash ^ word) * 0xbf58476d1ce4e5b9ull;
+        hash ^= hash >> 31;
+        text += 8;
+        len -= 8;
     }
-    return hash;
+    if (len) {
+        uint64_t word = 0;
+        memcpy(&word, text, len);
+        hash = (hash ^ word) * 0xbf58476d1ce4e5b9ull;
+        hash ^= hash >> 31;
+    }
+    hash *= 0x94d049bb133111ebull;
+    hash ^= hash >> 32;
+    return (uint32_t)hash;
 }
 
-static bool termpaintp_hash_grow(termpaint_hash* p) {
-    int old_allocated = p->allocated;
-    termpaint_hash_item** old_buckets = p->buckets;
-    p->allocated *= 2;
-    p->buckets = (termpaint_hash_item**)calloc(p->allocated, sizeof(*p->buckets));
-    if (!p->buckets) {
-        p->allocated = old_allocated;
-        p->buckets = old_buckets;
-        return false;
+static void termpaintp_hash_insert_slot(termpaint_hash_slot* slots, int allocated, uint32_t hash,
+                                        termpaint_hash_item* item) {
+    const uint32_t mask = (uint32_t)allocated - 1;
+    uint32_t i = hash & mask;
+    while (slots[i].item) {
+        i = (i + 1) & mask;
     }
+    slots[i].hash = hash;
+    slots[i].item = item;
+}
 
-    for (int i = 0; i < old_allocated; i++) {
-        termpaint_hash_item* item_it = old_buckets[i];
-        while (item_it) {
-            termpaint_hash_item* item = item_it;
-            item_it = item->next;
-
-            uint32_t bucket = termpaintp_hash_fnv1a(item->text) % p->allocated;
-            item->next = p->buckets[bucket];
-            p->buckets[bucket] = item;
+// Removes the item in slot i and moves later items of the same probe sequence into the gap.
+static void termpaintp_hash_remove_slot(termpaint_hash* p, uint32_t i) {
+    const uint32_t mask = (uint32_t)p->allocated - 1;
+    uint32_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (!p->slots[j].item) {
+            break;
+        }
+        const uint32_t home = p->slots[j].hash & mask;
+        // the item in j can only move to i if i is not between its home slot and j.
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            p->slots[i] = p->slots[j];
+            i = j;
         }
     }
-    free(old_buckets);
-    return true;
+    p->slots[i].item = (termpaint_hash_item*)0;
 }
 
-static int termpaintp_hash_gc(termpaint_hash* p) {
-    if (!p->gc_mark_cb) {
-        return 0;
+static bool termpaintp_hash_grow(termpaint_hash* p) {
+    if (p->allocated <= 0 || p->allocated > INT_MAX / 2) {
+        return false;
     }
-
-    int items_removed = 0;
-
-    for (int i = 0; i < p->allocated; i++) {
-        termpaint_hash_item* item_it = p->buckets[i];
-        while (item_it) {
-            item_it->unused = true;
-            item_it = item_it->next;
-        }
+    int new_allocated = p->allocated * 2;
+    termpaint_hash_slot* new_slots = (termpaint_hash_slot*)calloc(new_allocated, sizeof(termpaint_hash_slot));
+    if (!new_slots) {
+        return false;
     }
 
-    p->gc_mark_cb(p);
-
     for (int i = 0; i < p->allocated; i++) {
-        termpaint_hash_item** prev_ptr = &p->buckets[i];
-        termpaint_hash_item* item = *prev_ptr;
-        while (item) {
-            termpaint_hash_item* old = item;
-            if (item->unused) {
-                *prev_ptr = item->next;
-            } else {
-                prev_ptr = &item->next;
-            }
-            item = item->next;
-            if (old->unused) {
-                --p->count;
-                if (p->destroy_cb) {
-                    p->destroy_cb(old);
-                }
-                free(old->text);
-                free(old);
-                ++items_removed;
-            }
+        if (p->slots[i].item) {
+            // the stored hash avoids reading the strings again
+            termpaintp_hash_insert_slot(new_slots, new_allocated, p->slots[i].hash, p->slots[i].item);
         }
     }
-    return items_removed;
+    free(p->slots);
+    p->slots = new_slots;
+    p->allocated = new_allocated;
+    return true;
 }
 
-static void* termpaintp_hash_ensure(termpaint_hash* p, const unsigned char* text) {
-    if (!p->allocated) {
-        p->allocated = 32;
-        p->buckets = (termpaint_hash_item**)calloc(p->allocated, sizeof(termpaint_hash_item*));
-        if (!p->buckets) {
-            p->allocated = 0;
-            return NULL;
-        }
+// Size class for an item with text of length len, -1 if it does not fit in a slab block.
+static int termpaintp_hash_slab_class(termpaint_hash* p, size_t len) {
+    const size_t size = p->item_size + len + 1;
+    if (!p->use_slab || size > TERMPAINTP_HASH_SLAB_GRANULE * TERMPAINTP_HASH_SLAB_CLASSES) {
+        return -1;
     }
-    uint32_t bucket = termpaintp_hash_fnv1a(text) % p->allocated;
+    return (int)((size - 1) / TERMPAINTP_HASH_SLAB_GRANULE);
+}
 
-    if (p->buckets[bucket]) {
-        termpaint_hash_item* item = p->buckets[bucket];
-        termpaint_hash_item* prev = item;
-        while (item) {
-            prev = item;
-            if (strcmp((const char*)text, (char*)item->text) == 0) {
-                return item;
-            }
-            item = item->next;
-        }
-        if (p->allocated / 2 <= p->count) {
-            if (termpaintp_hash_gc(p) == 0) {
-                if (!termpaintp_hash_grow(p)) {
-                    return NULL;
-                }
-            }
-            // either termpaintp_hash_gc or termpaintp_hash_grow have invalidated `prev` but now capacity is free
-            return termpaintp_hash_ensure(p, text);
-        } else {
+static termpaint_hash_item* termpaintp_hash_alloc_item(termpaint_hash* p, const unsigned char* text) {
+    const size_t len = strlen((const char*)text);
+    const int size_class = termpaintp_hash_slab_class(p, len);
+    termpaint_hash_item* item;
+    if (size_class < 0) {
+        if (!p->use_slab) {
             item = (termpaint_hash_item*)calloc(1, p->item_size);
             if (!item) {
                 return NULL;
@@ -141,66 +147,198 @@ static void* termpaintp_hash_ensure(termpaint_hash* p, const unsigned char* text
                 free(item);
                 return NULL;
             }
-            prev->next = item;
-            p->count++;
             return item;
         }
+        item = (termpaint_hash_item*)calloc(1, p->item_size + len + 1);
+        if (!item) {
+            return NULL;
+        }
     } else {
-        if (p->allocated / 2 <= p->count && termpaintp_hash_gc(p) == 0) {
-            if (!termpaintp_hash_grow(p)) {
-                return NULL;
-            }
-            return termpaintp_hash_ensure(p, text);
+        const size_t block_size = (size_t)(size_class + 1) * TERMPAINTP_HASH_SLAB_GRANULE;
+        if (p->slab_free[size_class]) {
+            item = (termpaint_hash_item*)p->slab_free[size_class];
+            memcpy(&p->slab_free[size_class], item, sizeof(void*));
         } else {
-            termpaint_hash_item* item = (termpaint_hash_item*)calloc(1, p->item_size);
-            if (!item) {
-                return NULL;
+            if ((size_t)(p->slab_end - p->slab_pos) < block_size) {
+                termpaint_hash_slab* slab = (termpaint_hash_slab*)malloc(TERMPAINTP_HASH_SLAB_SIZE);
+                if (!slab) {
+                    return NULL;
+                }
+                slab->next = p->slabs;
+                p->slabs = slab;
+                p->slab_pos = (unsigned char*)slab + TERMPAINTP_HASH_SLAB_GRANULE;
+                p->slab_end = (unsigned char*)slab + TERMPAINTP_HASH_SLAB_SIZE;
             }
-            item->text = (unsigned char*)strdup((const char*)text);
-            if (!item->text) {
-                free(item);
+            item = (termpaint_hash_item*)(void*)p->slab_pos;
+            p->slab_pos += block_size;
+        }
+        memset(item, 0, p->item_size);
+    }
+    item->text = (unsigned char*)item + p->item_size;
+    memcpy(item->text, text, len + 1);
+    return item;
+}
+
+static void termpaintp_hash_free_item(termpaint_hash* p, termpaint_hash_item* item) {
+    if (p->destroy_cb) {
+        p->destroy_cb(item);
+    }
+    if (!p->use_slab) {
+        free(item->text);
+        free(item);
+        return;
+    }
+    const int size_class = termpaintp_hash_slab_class(p, strlen((const char*)item->text));
+    if (size_class < 0) {
+        free(item);
+    } else {
+        memcpy(item, &p->slab_free[size_class], sizeof(void*));
+        p->slab_free[size_class] = item;
+    }
+}
+
+static void termpaintp_hash_free_slabs(termpaint_hash* p, termpaint_hash_slab* keep) {
+    termpaint_hash_slab* slab = p->slabs;
+    while (slab) {
+        termpaint_hash_slab* next = slab->next;
+        if (slab != keep) {
+            free(slab);
+        }
+        slab = next;
+    }
+    p->slabs = keep;
+    if (keep) {
+        keep->next = (termpaint_hash_slab*)0;
+        p->slab_pos = (unsigned char*)keep + TERMPAINTP_HASH_SLAB_GRANULE;
+        p->slab_end = (unsigned char*)keep + TERMPAINTP_HASH_SLAB_SIZE;
+    } else {
+        p->slab_pos = (unsigned char*)0;
+        p->slab_end = (unsigned char*)0;
+    }
+    for (int i = 0; i < TERMPAINTP_HASH_SLAB_CLASSES; i++) {
+        p->slab_free[i] = (void*)0;
+    }
+}
+
+// Marks all items as unused. Garbage collection can also be driven by the user of the hash: Call this, then mark
+// items in use by setting unused to false and finally call termpaintp_hash_gc_sweep. Items added in between are
+// not unused.
+static void termpaintp_hash_gc_begin(termpaint_hash* p) {
+    for (int i = 0; i < p->allocated; i++) {
+        if (p->slots[i].item) {
+            p->slots[i].item->unused = true;
+        }
+    }
+}
+
+// Removes all items that are still marked as unused.
+static int termpaintp_hash_gc_sweep(termpaint_hash* p) {
+    int items_removed = 0;
+
+    for (int i = 0; i < p->allocated; i++) {
+        // removing can move a not yet visited item into slot i, so check it again.
+        while (p->slots[i].item && p->slots[i].item->unused) {
+            termpaint_hash_item* old = p->slots[i].item;
+            termpaintp_hash_remove_slot(p, i);
+            --p->count;
+            termpaintp_hash_free_item(p, old);
+            ++items_removed;
+        }
+    }
+    return items_removed;
+}
+
+static int termpaintp_hash_gc(termpaint_hash* p) {
+    if (!p->gc_mark_cb) {
+        return 0;
+    }
+
+    termpaintp_hash_gc_begin(p);
+    p->gc_mark_cb(p);
+    return termpaintp_hash_gc_sweep(p);
+}
+
+static termpaint_hash_item* termpaintp_hash_find(termpaint_hash* p, const unsigned char* text, uint32_t hash) {
+    const uint32_t mask = (uint32_t)p->allocated - 1;
+    for (uint32_t i = hash & mask; p->slots[i].item; i = (i + 1) & mask) {
+        if (p->slots[i].hash == hash && strcmp((const char*)text, (char*)p->slots[i].item->text) == 0) {
+            return p->slots[i].item;
+        }
+    }
+    return (termpaint_hash_item*)0;
+}
+
+static void* termpaintp_hash_ensure(termpaint_hash* p, const unsigned char* text) {
+    if (!p->allocated) {
+        p->slots = (termpaint_hash_slot*)calloc(32, sizeof(termpaint_hash_slot));
+        if (!p->slots) {
+            return NULL;
+        }
+        p->allocated = 32;
+    }
+    const uint32_t hash = termpaintp_hash_string(text);
+
+    termpaint_hash_item* item = termpaintp_hash_find(p, text, hash);
+    if (item) {
+        return item;
+    }
+
+    if (p->allocated / 2 <= p->count) {
+        if (termpaintp_hash_gc(p) == 0) {
+            if (!termpaintp_hash_grow(p)) {
                 return NULL;
             }
-            p->count++;
-            p->buckets[bucket] = item;
-            return item;
         }
     }
+
+    item = termpaintp_hash_alloc_item(p, text);
+    if (!item) {
+        return NULL;
+    }
+    termpaintp_hash_insert_slot(p->slots, p->allocated, hash, item);
+    p->count++;
+    return item;
 }
 
 static void* termpaintp_hash_get(termpaint_hash* p, const unsigned char* text) {
     if (!p->allocated) {
         return NULL;
     }
-    uint32_t bucket = termpaintp_hash_fnv1a(text) % p->allocated;
+    return termpaintp_hash_find(p, text, termpaintp_hash_string(text));
+}
 
-    if (p->buckets[bucket]) {
-        termpaint_hash_item* item = p->buckets[bucket];
-        while (item) {
-            if (strcmp((const char*)text, (char*)item->text) == 0) {
-                return item;
+// Removes all items. Slab memory is kept for reuse, except for items that did not fit into a slab block.
+static void termpaintp_hash_clear(termpaint_hash* p) {
+    if (!p->count) {
+        return;
+    }
+    for (int i = 0; i < p->allocated; i++) {
+        termpaint_hash_item* item = p->slots[i].item;
+        if (item) {
+            if (p->destroy_cb || termpaintp_hash_slab_class(p, strlen((const char*)item->text)) < 0) {
+                termpaintp_hash_free_item(p, item);
             }
-            item = item->next;
+            p->slots[i].item = (termpaint_hash_item*)0;
         }
     }
-    return NULL;
+    p->count = 0;
+    if (p->use_slab) {
+        termpaintp_hash_free_slabs(p, p->slabs);
+    }
 }
 
 static void termpaintp_hash_destroy(termpaint_hash* p) {
     for (int i = 0; i < p->allocated; i++) {
-        termpaint_hash_item* item = p->buckets[i];
-        while (item) {
-            termpaint_hash_item* old = item;
-            item = item->next;
-            if (p->destroy_cb) {
-                p->destroy_cb(old);
+        if (p->slots[i].item) {
+            termpaint_hash_item* item = p->slots[i].item;
+            if (!p->use_slab || p->destroy_cb || termpaintp_hash_slab_class(p, strlen((const char*)item->text)) < 0) {
+                termpaintp_hash_free_item(p, item);
             }
-            free(old->text);
-            free(old);
         }
     }
-    free(p->buckets);
-    p->buckets = (termpaint_hash_item**)0;
+    termpaintp_hash_free_slabs(p, (termpaint_hash_slab*)0);
+    free(p->slots);
+    p->slots = (termpaint_hash_slot*)0;
     p->allocated = 0;
     p->count = 0;
 }
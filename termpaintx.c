@@ -19,6 +19,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <termpaint_compiler.h>
 #include <termpaintx_ttyrescue.h>
@@ -45,8 +49,51 @@ typedef struct termpaint_integration_fd_ {
     bool poll_sigwinch;
     termpaint_terminal *terminal;
     termpaintx_ttyrescue *rescue;
+    char *output_buffer;
+    unsigned output_buffer_len;
+    unsigned output_buffer_alloc;
+    unsigned output_buffer_size;
+    unsigned output_buffer_high_water_mark;
+    bool restore_fd_flags;
+    int original_fd_flags;
+
+    // +asyncwrite: single producer / single consumer ring buffer drained by a writer thread.
+    // Positions count bytes since creation, the ring index is position & (async_ring_size - 1).
+    bool async;
+    pthread_t async_thread;
+    pthread_mutex_t async_mutex; // only used for sleeping, not for ring access
+    pthread_cond_t async_cond;
+    char *async_ring;
+    size_t async_ring_size;
+    size_t async_head; // only accessed by the application thread
+    _Atomic size_t async_published;
+    _Atomic size_t async_tail;
+    atomic_bool async_stop;
+    atomic_bool async_failed;
+    int async_fd;
+    // the writer thread writes to the pipe when the ring runs empty while the iteration waits for that
+    int async_wake_pipe[2];
+    atomic_bool async_wake_requested;
+
+    // repaint scheduling
+    bool repaint_requested;
+    bool repainted_before;
+    int frame_interval_ms;
+    int64_t last_repaint_ns;
+
+    // output rate measurement, bytes and time spent in write calls since the last report
+    int64_t rate_bytes;
+    int64_t rate_ns;
+    _Atomic int64_t async_rate_bytes;
+    _Atomic int64_t async_rate_ns;
 } termpaint_integration_fd;
 
+// Writes that finish faster than this did not wait for the terminal and say nothing about the output rate.
+#define TERMPAINTX_RATE_MIN_NS 1000000
+
+#define TERMPAINTX_DEFAULT_OUTPUT_BUFFER_SIZE 16384
+#define TERMPAINTX_DEFAULT_ASYNC_BUFFER_SIZE 262144
+
 static bool sigwinch_set;
 static int sigwinch_pipe[2];
 
@@ -146,8 +193,13 @@ termpaint_integration *termpaintx_full_integration_from_controlling_terminal(con
 }
 
 
+static void termpaintp_fd_drain_output(termpaint_integration_fd *t);
+static void termpaintp_fd_async_stop(termpaint_integration_fd *t);
+
 static void fd_free(termpaint_integration* integration) {
     termpaint_integration_fd* fd_data = FDPTR(integration);
+    termpaintp_fd_drain_output(fd_data);
+    termpaintp_fd_async_stop(fd_data);
     // If terminal auto detection or another operation with response is cut short
     // by a close the reponse will leak out into the next application.
     // We can't reliably prevent that here, but this kludge can reduce the likelyhood
@@ -183,41 +235,101 @@ static void fd_free(termpaint_integration* integration) {
         fd_data->rescue = nullptr;
     }
 
+    if (fd_data->restore_fd_flags && fd_data->fd != -1) {
+        fcntl(fd_data->fd, F_SETFL, fd_data->original_fd_flags);
+    }
     tcsetattr (fd_data->fd, TCSAFLUSH, &fd_data->original_terminal_attributes);
     if (fd_data->auto_close && fd_data->fd != -1) {
         close(fd_data->fd);
     }
     free(fd_data->options);
+    free(fd_data->output_buffer);
     termpaint_integration_deinit(&fd_data->base);
     free(fd_data);
 }
 
-static void fd_flush(termpaint_integration* integration) {
+static int64_t fd_monotonic_clock_ns(struct termpaint_integration_ *integration) {
     (void)integration;
-    // no buffering yet
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
 }
 
 static void fd_mark_bad(termpaint_integration* integration) {
     FDPTR(integration)->fd = -1;
+    FDPTR(integration)->output_buffer_len = 0;
 }
 
 static _Bool fd_is_bad(termpaint_integration* integration) {
-    return FDPTR(integration)->fd == -1;
+    termpaint_integration_fd *t = FDPTR(integration);
+    if (t->async && atomic_load_explicit(&t->async_failed, memory_order_relaxed)) {
+        fd_mark_bad(integration);
+    }
+    return t->fd == -1;
 }
 
-static void fd_write(termpaint_integration* integration, const char *data, int length) {
-    ssize_t written = 0;
+// Keeps output not yet accepted by the kernel in the output buffer. iov[0] may point into the output buffer.
+static bool termpaintp_fd_queue_unwritten(termpaint_integration_fd *t, struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (total > UINT_MAX / 2) {
+        return false;
+    }
+    char *dest = t->output_buffer;
+    unsigned new_alloc = t->output_buffer_alloc;
+    if (total > t->output_buffer_alloc) {
+        new_alloc = new_alloc ? new_alloc : 4096;
+        while (new_alloc < total) {
+            new_alloc *= 2;
+        }
+        dest = malloc(new_alloc);
+        if (!dest) {
+            return false;
+        }
+    }
+    size_t offset = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memmove(dest + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    if (dest != t->output_buffer) {
+        free(t->output_buffer);
+        t->output_buffer = dest;
+        t->output_buffer_alloc = new_alloc;
+    }
+    t->output_buffer_len = (unsigned)total;
+    return true;
+}
+
+static void termpaintp_fd_writev_all(termpaint_integration* integration, struct iovec *iov, int iovcnt) {
     ssize_t ret;
     errno = 0;
-    while (written != length) {
-        ret = write(FDPTR(integration)->fd, data+written, length-written);
+    while (iovcnt) {
+        if (!iov->iov_len) {
+            ++iov;
+            --iovcnt;
+            continue;
+        }
+        ret = writev(FDPTR(integration)->fd, iov, iovcnt);
         if (ret > 0) {
-            written += ret;
+            while (ret && (size_t)ret >= iov->iov_len) {
+                ret -= iov->iov_len;
+                ++iov;
+                --iovcnt;
+            }
+            if (ret) {
+                iov->iov_base = (char*)iov->iov_base + ret;
+                iov->iov_len -= ret;
+            }
         } else {
             // error handling?
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // fatal, non blocking is not supported by this integration
-                fd_mark_bad(integration);
+                // non blocking fd, keep the rest for later
+                if (!termpaintp_fd_queue_unwritten(FDPTR(integration), iov, iovcnt)) {
+                    fd_mark_bad(integration);
+                }
                 return;
             }
             if (errno == EIO || errno == ENOSPC) {
@@ -237,6 +349,307 @@ static void fd_write(termpaint_integration* integration, const char *data, int l
     }
 }
 
+static void termpaintp_fd_writev_all_measured(termpaint_integration* integration, struct iovec *iov, int iovcnt) {
+    termpaint_integration_fd *t = FDPTR(integration);
+    const int64_t start_ns = fd_monotonic_clock_ns(integration);
+    for (int i = 0; i < iovcnt; i++) {
+        t->rate_bytes += (int64_t)iov[i].iov_len;
+    }
+    termpaintp_fd_writev_all(integration, iov, iovcnt);
+    t->rate_ns += fd_monotonic_clock_ns(integration) - start_ns;
+}
+
+static void termpaintp_fd_async_notify(termpaint_integration_fd *t) {
+    pthread_mutex_lock(&t->async_mutex);
+    pthread_cond_broadcast(&t->async_cond);
+    pthread_mutex_unlock(&t->async_mutex);
+}
+
+// called by the writer thread after advancing async_tail
+static void termpaintp_fd_async_wake_iteration(termpaint_integration_fd *t, size_t tail) {
+    if (atomic_load(&t->async_published) == tail && atomic_exchange(&t->async_wake_requested, false)) {
+        char dummy = ' ';
+        (void)!write(t->async_wake_pipe[1], &dummy, 1); // pipe full means a wake up is already pending
+    }
+}
+
+static void *termpaintp_fd_async_writer(void *arg) {
+    termpaint_integration_fd *t = arg;
+    size_t tail = atomic_load_explicit(&t->async_tail, memory_order_relaxed);
+    while (true) {
+        size_t published = atomic_load_explicit(&t->async_published, memory_order_acquire);
+        if (published == tail) {
+            pthread_mutex_lock(&t->async_mutex);
+            while (atomic_load_explicit(&t->async_published, memory_order_acquire) == tail
+                   && !atomic_load_explicit(&t->async_stop, memory_order_relaxed)) {
+                pthread_cond_wait(&t->async_cond, &t->async_mutex);
+            }
+            pthread_mutex_unlock(&t->async_mutex);
+            if (atomic_load_explicit(&t->async_published, memory_order_acquire) == tail) {
+                break;
+            }
+            continue;
+        }
+
+        if (atomic_load_explicit(&t->async_failed, memory_order_relaxed)) {
+            // discard everything, the application thread reports the failure via is_bad
+            tail = published;
+            atomic_store(&t->async_tail, tail);
+            termpaintp_fd_async_notify(t);
+            termpaintp_fd_async_wake_iteration(t, tail);
+            continue;
+        }
+
+        size_t offset = tail & (t->async_ring_size - 1);
+        size_t len = published - tail;
+        if (len > t->async_ring_size - offset) {
+            len = t->async_ring_size - offset;
+        }
+        const int64_t start_ns = fd_monotonic_clock_ns(&t->base);
+        ssize_t ret = write(t->async_fd, t->async_ring + offset, len);
+        if (ret > 0) {
+            atomic_fetch_add_explicit(&t->async_rate_bytes, ret, memory_order_relaxed);
+            atomic_fetch_add_explicit(&t->async_rate_ns, fd_monotonic_clock_ns(&t->base) - start_ns, memory_order_relaxed);
+            tail += (size_t)ret;
+            atomic_store(&t->async_tail, tail);
+            termpaintp_fd_async_notify(t);
+            termpaintp_fd_async_wake_iteration(t, tail);
+        } else if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // non blocking fd, wait for the kernel to accept more data
+            struct pollfd info;
+            info.fd = t->async_fd;
+            info.events = POLLOUT;
+            int pret = poll(&info, 1, 1000);
+            if (pret == 0 || (pret < 0 && errno != EINTR)) {
+                // give up, the other side does not accept more data
+                atomic_store_explicit(&t->async_failed, true, memory_order_relaxed);
+            }
+        } else {
+            atomic_store_explicit(&t->async_failed, true, memory_order_relaxed);
+        }
+    }
+    return nullptr;
+}
+
+static bool termpaintp_fd_async_start(termpaint_integration_fd *t, size_t ring_size) {
+    bool ok = true;
+#ifdef __linux__
+    ok &= (pipe2(t->async_wake_pipe, O_CLOEXEC | O_NONBLOCK) == 0);
+#else
+    ok &= (pipe(t->async_wake_pipe) == 0);
+    ok &= (fcntl(t->async_wake_pipe[0], F_SETFD, FD_CLOEXEC) == 0);
+    ok &= (fcntl(t->async_wake_pipe[1], F_SETFD, FD_CLOEXEC) == 0);
+    ok &= (fcntl(t->async_wake_pipe[0], F_SETFL, O_NONBLOCK) == 0);
+    ok &= (fcntl(t->async_wake_pipe[1], F_SETFL, O_NONBLOCK) == 0);
+#endif
+    if (!ok) {
+        return false;
+    }
+    t->async_ring = malloc(ring_size);
+    if (!t->async_ring) {
+        close(t->async_wake_pipe[0]);
+        close(t->async_wake_pipe[1]);
+        return false;
+    }
+    t->async_ring_size = ring_size;
+    t->async_head = 0;
+    atomic_init(&t->async_published, 0);
+    atomic_init(&t->async_tail, 0);
+    atomic_init(&t->async_stop, false);
+    atomic_init(&t->async_failed, false);
+    atomic_init(&t->async_wake_requested, false);
+    atomic_init(&t->async_rate_bytes, 0);
+    atomic_init(&t->async_rate_ns, 0);
+    t->async_fd = t->fd;
+    pthread_mutex_init(&t->async_mutex, nullptr);
+    pthread_cond_init(&t->async_cond, nullptr);
+
+    // signals should be delivered to application threads, not the writer
+    sigset_t all_signals, old_signals;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+    int ret = pthread_create(&t->async_thread, nullptr, termpaintp_fd_async_writer, t);
+    pthread_sigmask(SIG_SETMASK, &old_signals, nullptr);
+
+    if (ret != 0) {
+        pthread_cond_destroy(&t->async_cond);
+        pthread_mutex_destroy(&t->async_mutex);
+        free(t->async_ring);
+        t->async_ring = nullptr;
+        close(t->async_wake_pipe[0]);
+        close(t->async_wake_pipe[1]);
+        return false;
+    }
+    t->async = true;
+    return true;
+}
+
+static void termpaintp_fd_async_stop(termpaint_integration_fd *t) {
+    if (!t->async) {
+        return;
+    }
+    atomic_store_explicit(&t->async_stop, true, memory_order_relaxed);
+    termpaintp_fd_async_notify(t);
+    pthread_join(t->async_thread, nullptr);
+    pthread_cond_destroy(&t->async_cond);
+    pthread_mutex_destroy(&t->async_mutex);
+    free(t->async_ring);
+    t->async_ring = nullptr;
+    close(t->async_wake_pipe[0]);
+    close(t->async_wake_pipe[1]);
+    t->async = false;
+}
+
+static void termpaintp_fd_async_publish(termpaint_integration_fd *t) {
+    if (atomic_load_explicit(&t->async_published, memory_order_relaxed) == t->async_head) {
+        return;
+    }
+    atomic_store_explicit(&t->async_published, t->async_head, memory_order_release);
+    termpaintp_fd_async_notify(t);
+}
+
+// Waits until the writer thread transmitted (or discarded) everything up to position target.
+static void termpaintp_fd_async_wait(termpaint_integration_fd *t, size_t target) {
+    pthread_mutex_lock(&t->async_mutex);
+    // tail < target, written to be safe with wrapping positions
+    while (target - atomic_load_explicit(&t->async_tail, memory_order_acquire) - 1 < t->async_ring_size
+           && !atomic_load_explicit(&t->async_failed, memory_order_relaxed)) {
+        pthread_cond_wait(&t->async_cond, &t->async_mutex);
+    }
+    pthread_mutex_unlock(&t->async_mutex);
+}
+
+static void termpaintp_fd_async_write(termpaint_integration_fd *t, const char *data, unsigned length) {
+    while (length) {
+        size_t tail = atomic_load_explicit(&t->async_tail, memory_order_acquire);
+        size_t space = t->async_ring_size - (t->async_head - tail);
+        if (!space) {
+            if (atomic_load_explicit(&t->async_failed, memory_order_relaxed)) {
+                return;
+            }
+            // ring is full, let the writer thread make progress
+            termpaintp_fd_async_publish(t);
+            termpaintp_fd_async_wait(t, tail + 1);
+            continue;
+        }
+        size_t offset = t->async_head & (t->async_ring_size - 1);
+        size_t len = length;
+        if (len > space) {
+            len = space;
+        }
+        if (len > t->async_ring_size - offset) {
+            len = t->async_ring_size - offset;
+        }
+        memcpy(t->async_ring + offset, data, len);
+        t->async_head += len;
+        data += len;
+        length -= (unsigned)len;
+    }
+}
+
+// Passes the output rate observed while writing to the terminal object, which uses it to degrade output on slow
+// connections (see termpaint_terminal_set_low_bandwidth_threshold)
+static void termpaintp_fd_report_output_rate(termpaint_integration_fd *t) {
+    int64_t bytes = t->rate_bytes;
+    int64_t ns = t->rate_ns;
+    if (t->async) {
+        bytes += atomic_exchange_explicit(&t->async_rate_bytes, 0, memory_order_relaxed);
+        ns += atomic_exchange_explicit(&t->async_rate_ns, 0, memory_order_relaxed);
+    }
+    if (!bytes) {
+        return;
+    }
+    t->rate_bytes = 0;
+    t->rate_ns = 0;
+    if (!t->terminal) {
+        return;
+    }
+    int rate = 0; // writes did not have to wait, output is not limited by the connection
+    if (ns >= TERMPAINTX_RATE_MIN_NS) {
+        int64_t bytes_per_second = bytes * 1000000000 / ns;
+        rate = bytes_per_second > INT_MAX ? INT_MAX : bytes_per_second < 1 ? 1 : (int)bytes_per_second;
+    }
+    termpaint_terminal_set_output_rate(t->terminal, rate);
+}
+
+static void fd_flush(termpaint_integration* integration) {
+    termpaint_integration_fd *t = FDPTR(integration);
+    if (t->async) {
+        termpaintp_fd_async_publish(t);
+        termpaintp_fd_report_output_rate(t);
+        return;
+    }
+    if (t->output_buffer_len) {
+        struct iovec iov[1];
+        iov[0].iov_base = t->output_buffer;
+        iov[0].iov_len = t->output_buffer_len;
+        t->output_buffer_len = 0;
+        termpaintp_fd_writev_all_measured(integration, iov, 1);
+    }
+    termpaintp_fd_report_output_rate(t);
+}
+
+static void fd_write(termpaint_integration* integration, const char *data, int length) {
+    termpaint_integration_fd *t = FDPTR(integration);
+    if (length <= 0) {
+        return;
+    }
+
+    if (t->async) {
+        size_t pending = t->async_head - atomic_load_explicit(&t->async_tail, memory_order_relaxed) + (unsigned)length;
+        if (pending > t->output_buffer_high_water_mark) {
+            t->output_buffer_high_water_mark = pending > UINT_MAX ? UINT_MAX : (unsigned)pending;
+        }
+        termpaintp_fd_async_write(t, data, (unsigned)length);
+        return;
+    }
+
+    unsigned pending = t->output_buffer_len + (unsigned)length;
+    if (pending > t->output_buffer_high_water_mark) {
+        t->output_buffer_high_water_mark = pending;
+    }
+
+    // output_buffer_alloc only exceeds output_buffer_size while output is queued on a non blocking fd
+    if (pending <= t->output_buffer_size || (t->output_buffer_len && pending <= t->output_buffer_alloc)) {
+        memcpy(t->output_buffer + t->output_buffer_len, data, (unsigned)length);
+        t->output_buffer_len = pending;
+        return;
+    }
+
+    // does not fit, pass buffer contents and new data to the kernel in one go
+    struct iovec iov[2];
+    iov[0].iov_base = t->output_buffer;
+    iov[0].iov_len = t->output_buffer_len;
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = (unsigned)length;
+    t->output_buffer_len = 0;
+    termpaintp_fd_writev_all_measured(integration, iov, 2);
+}
+
+static void termpaintp_fd_drain_output(termpaint_integration_fd *t) {
+    if (t->async) {
+        termpaintp_fd_async_publish(t);
+        termpaintp_fd_async_wait(t, t->async_head);
+        return;
+    }
+    while (t->fd != -1) {
+        fd_flush(&t->base);
+        if (!t->output_buffer_len) {
+            break;
+        }
+        struct pollfd info;
+        info.fd = t->fd;
+        info.events = POLLOUT;
+        int ret = poll(&info, 1, 1000);
+        if (ret == 0 || (ret < 0 && errno != EINTR)) {
+            // give up, the other side does not accept more data
+            break;
+        }
+    }
+}
+
 static void fd_request_callback(struct termpaint_integration_ *integration) {
     FDPTR(integration)->callback_requested = true;
 }
@@ -263,6 +676,26 @@ static bool termpaintp_has_option(const char *options, const char *name) {
     return false;
 }
 
+static int termpaintp_option_int(const char *options, const char *name, int default_value) {
+    const char *p = options;
+    int name_len = strlen(name);
+    while (1) {
+        const char *found = strstr(p, name);
+        if (!found) {
+            break;
+        }
+        if ((found == options || found[-1] == ' ') && found[name_len] == '=') {
+            char *end;
+            long value = strtol(found + name_len + 1, &end, 10);
+            if (end != found + name_len + 1 && (*end == 0 || *end == ' ') && value >= 0 && value <= 0x7fffffff) {
+                return (int)value;
+            }
+        }
+        p = found + name_len;
+    }
+    return default_value;
+}
+
 static bool termpaintp_fd_set_termios(int fd, const char *options) {
     struct termios tattr;
     tcgetattr(fd, &tattr);
@@ -306,12 +739,41 @@ termpaint_integration *termpaintx_full_integration_from_fd(int fd, _Bool auto_cl
     termpaint_integration_set_is_bad(&ret->base, fd_is_bad);
     termpaint_integration_set_request_callback(&ret->base, fd_request_callback);
     termpaint_integration_set_awaiting_response(&ret->base, fd_awaiting_response);
+    termpaint_integration_set_monotonic_clock_ns(&ret->base, fd_monotonic_clock_ns);
     ret->options = strdup(options);
     ret->fd = fd;
     ret->auto_close = auto_close;
     ret->callback_requested = false;
     ret->awaiting_response = false;
 
+    if (termpaintp_has_option(options, "+asyncwrite")) {
+        size_t ring_size = 4096;
+        size_t requested = (size_t)termpaintp_option_int(options, "asyncbuffer", TERMPAINTX_DEFAULT_ASYNC_BUFFER_SIZE);
+        while (ring_size < requested && ring_size < (size_t)1 << 30) {
+            ring_size *= 2;
+        }
+        // on failure silently fall back to writing from the application thread
+        termpaintp_fd_async_start(ret, ring_size);
+    }
+
+    ret->output_buffer_size = ret->async ? 0 : termpaintp_option_int(options, "outputbuffer", TERMPAINTX_DEFAULT_OUTPUT_BUFFER_SIZE);
+    if (ret->output_buffer_size) {
+        ret->output_buffer = malloc(ret->output_buffer_size);
+        if (!ret->output_buffer) {
+            // degrade to unbuffered output
+            ret->output_buffer_size = 0;
+        }
+    }
+    ret->output_buffer_alloc = ret->output_buffer_size;
+
+    if (termpaintp_has_option(options, "+nonblocking")) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags != -1 && !(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1) {
+            ret->restore_fd_flags = true;
+            ret->original_fd_flags = flags;
+        }
+    }
+
     tcgetattr(ret->fd, &ret->original_terminal_attributes);
     termpaintp_fd_set_termios(ret->fd, options);
     return (termpaint_integration*)ret;
@@ -337,6 +799,7 @@ void termpaintx_full_integration_wait_for_ready_with_message(termpaint_integrati
             }
             if (milliseconds <= 0) {
                 fd_write(integration, message, strlen(message));
+                fd_flush(integration);
             }
         } else {
             if (!termpaintx_full_integration_do_iteration(integration)) {
@@ -359,6 +822,58 @@ void termpaintx_full_integration_set_terminal(termpaint_integration *integration
     t->terminal = terminal;
 }
 
+void termpaintx_full_integration_set_frame_interval(termpaint_integration *integration, int milliseconds) {
+    termpaint_integration_fd *t = FDPTR(integration);
+    t->frame_interval_ms = milliseconds > 0 ? milliseconds : 0;
+}
+
+void termpaintx_full_integration_request_repaint(termpaint_integration *integration) {
+    termpaint_integration_fd *t = FDPTR(integration);
+    t->repaint_requested = true;
+}
+
+// returns -1 if no repaint is scheduled, otherwise the milliseconds until the scheduled repaint is due
+static int termpaintp_fd_repaint_timeout(termpaint_integration_fd *t) {
+    if (!t->repaint_requested || !t->terminal) {
+        return -1;
+    }
+    int remaining = 0;
+    if (t->repainted_before) {
+        int64_t elapsed_ms = (fd_monotonic_clock_ns(&t->base) - t->last_repaint_ns) / 1000000;
+        if (elapsed_ms < t->frame_interval_ms) {
+            remaining = t->frame_interval_ms - (int)elapsed_ms;
+        }
+    }
+    if (t->output_buffer_len) {
+        // wait for the queued output to drain, the poll for POLLOUT wakes up the iteration
+        return -1;
+    }
+    if (t->async) {
+        // ask the writer thread to wake up the iteration when the ring runs empty. Checking the tail again after
+        // the request ensures that either the check here or the writer thread sees that the ring is empty.
+        atomic_store(&t->async_wake_requested, true);
+        if (t->async_head != atomic_load(&t->async_tail)) {
+            return -1;
+        }
+        atomic_store(&t->async_wake_requested, false);
+    }
+    return remaining;
+}
+
+int termpaintx_full_integration_repaint_timeout(termpaint_integration *integration) {
+    return termpaintp_fd_repaint_timeout(FDPTR(integration));
+}
+
+static void termpaintp_fd_run_scheduled_repaint(termpaint_integration_fd *t) {
+    if (termpaintp_fd_repaint_timeout(t) != 0) {
+        return;
+    }
+    t->repaint_requested = false;
+    t->repainted_before = true;
+    t->last_repaint_ns = fd_monotonic_clock_ns(&t->base);
+    termpaint_terminal_flush(t->terminal, false);
+}
+
 static void termpaintp_handle_self_pipe(termpaint_integration_fd *t, struct pollfd *pfd) {
     if (pfd->revents == POLLIN) {
         // drain signaling pipe
@@ -378,24 +893,73 @@ static void termpaintp_handle_self_pipe(termpaint_integration_fd *t, struct poll
     }
 }
 
+static void termpaintp_fd_async_handle_wake_pipe(termpaint_integration_fd *t) {
+    // drain signaling pipe
+    char buff[100];
+    while (read(t->async_wake_pipe[0], buff, sizeof(buff)) > 0) {
+    }
+    termpaintp_fd_run_scheduled_repaint(t);
+}
+
 bool termpaintx_full_integration_do_iteration(termpaint_integration *integration) {
     termpaint_integration_fd *t = FDPTR(integration);
 
+    termpaintp_fd_run_scheduled_repaint(t);
+
+    // output from input processing (e.g. auto detection) is not followed by an explicit flush
+    fd_flush(integration);
+
+    if (fd_is_bad(integration)) {
+        // polling only ignored fds could block forever
+        return false;
+    }
+
     char buff[1000];
-    if (t->poll_sigwinch && sigwinch_set) {
-        struct pollfd info[2];
+    {
+        // always poll, the fd might be non blocking
+        int count = 1;
+        struct pollfd info[3];
         info[0].fd = t->fd;
         info[0].events = POLLIN;
-        info[1].fd = sigwinch_pipe[0];
-        info[1].events = POLLIN;
-        int ret = poll(info, 2, -1);
+        if (t->output_buffer_len) {
+            info[0].events |= POLLOUT;
+        }
+        int winch_index = -1;
+        if (t->poll_sigwinch && sigwinch_set) {
+            winch_index = count;
+            info[count].fd = sigwinch_pipe[0];
+            info[count].events = POLLIN;
+            ++count;
+        }
+        int wake_index = -1;
+        if (t->async) {
+            wake_index = count;
+            info[count].fd = t->async_wake_pipe[0];
+            info[count].events = POLLIN;
+            ++count;
+        }
+        int ret = poll(info, count, termpaintp_fd_repaint_timeout(t));
         if (ret < 0 && errno == EINTR) {
             return true;
         }
-        if (ret > 0 && info[1].revents != 0) {
-            termpaintp_handle_self_pipe(t, &info[1]);
+        if (ret == 0) {
+            termpaintp_fd_run_scheduled_repaint(t);
+            return true;
+        }
+        if (winch_index >= 0 && ret > 0 && info[winch_index].revents != 0) {
+            termpaintp_handle_self_pipe(t, &info[winch_index]);
+            return true;
+        }
+        if (wake_index >= 0 && ret > 0 && info[wake_index].revents != 0) {
+            termpaintp_fd_async_handle_wake_pipe(t);
             return true;
         }
+        if (ret > 0 && (info[0].revents & POLLOUT)) {
+            fd_flush(integration);
+            if (!(info[0].revents & ~POLLOUT)) {
+                return true;
+            }
+        }
     }
     int amount = (int)read(t->fd, buff, 999);
     if (amount < 0) {
@@ -436,6 +1000,16 @@ bool termpaintx_full_integration_do_iteration(termpaint_integration *integration
 bool termpaintx_full_integration_do_iteration_with_timeout(termpaint_integration *integration, int *milliseconds) {
     termpaint_integration_fd *t = FDPTR(integration);
 
+    termpaintp_fd_run_scheduled_repaint(t);
+
+    // output from input processing (e.g. auto detection) is not followed by an explicit flush
+    fd_flush(integration);
+
+    if (fd_is_bad(integration)) {
+        // polling only ignored fds could block forever
+        return false;
+    }
+
     char buff[1000];
 
     struct timespec start_time;
@@ -444,15 +1018,44 @@ bool termpaintx_full_integration_do_iteration_with_timeout(termpaint_integration
     int ret;
     {
         int count = 1;
-        struct pollfd info[2];
+        struct pollfd info[3];
         info[0].fd = t->fd;
         info[0].events = POLLIN;
+        if (t->output_buffer_len) {
+            info[0].events |= POLLOUT;
+        }
+        int winch_index = -1;
         if (t->poll_sigwinch && sigwinch_set) {
-            info[1].fd = sigwinch_pipe[0];
-            info[1].events = POLLIN;
+            winch_index = count;
+            info[count].fd = sigwinch_pipe[0];
+            info[count].events = POLLIN;
+            ++count;
+        }
+        int wake_index = -1;
+        if (t->async) {
+            wake_index = count;
+            info[count].fd = t->async_wake_pipe[0];
+            info[count].events = POLLIN;
             ++count;
         }
-        ret = poll(info, count, *milliseconds);
+        int timeout = *milliseconds;
+        int repaint_timeout = termpaintp_fd_repaint_timeout(t);
+        bool repaint_wakeup = repaint_timeout >= 0 && repaint_timeout < timeout;
+        if (repaint_wakeup) {
+            timeout = repaint_timeout;
+        }
+        ret = poll(info, count, timeout);
+        if (ret == 0 && repaint_wakeup) {
+            termpaintp_fd_run_scheduled_repaint(t);
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            *milliseconds -= ((now.tv_sec - start_time.tv_sec) * 1000
+                       + now.tv_nsec / 1000000 - start_time.tv_nsec / 1000000);
+            if (*milliseconds < 0) {
+                *milliseconds = 0;
+            }
+            return true;
+        }
         if (ret < 0 && errno == EINTR) {
             struct timespec now;
             clock_gettime(CLOCK_REALTIME, &now);
@@ -460,14 +1063,35 @@ bool termpaintx_full_integration_do_iteration_with_timeout(termpaint_integration
                        + now.tv_nsec / 1000000 - start_time.tv_nsec / 1000000);
             return true;
         }
-        if (count >= 2 && ret > 0 && info[1].revents != 0) {
-            termpaintp_handle_self_pipe(t, &info[1]);
+        if (winch_index >= 0 && ret > 0 && info[winch_index].revents != 0) {
+            termpaintp_handle_self_pipe(t, &info[winch_index]);
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            *milliseconds -= ((now.tv_sec - start_time.tv_sec) * 1000
+                       + now.tv_nsec / 1000000 - start_time.tv_nsec / 1000000);
+            return true;
+        }
+        if (wake_index >= 0 && ret > 0 && info[wake_index].revents != 0) {
+            termpaintp_fd_async_handle_wake_pipe(t);
             struct timespec now;
             clock_gettime(CLOCK_REALTIME, &now);
             *milliseconds -= ((now.tv_sec - start_time.tv_sec) * 1000
                        + now.tv_nsec / 1000000 - start_time.tv_nsec / 1000000);
+            if (*milliseconds < 0) {
+                *milliseconds = 0;
+            }
             return true;
         }
+        if (ret > 0 && (info[0].revents & POLLOUT)) {
+            fd_flush(integration);
+            if (!(info[0].revents & ~POLLOUT)) {
+                struct timespec now;
+                clock_gettime(CLOCK_REALTIME, &now);
+                *milliseconds -= ((now.tv_sec - start_time.tv_sec) * 1000
+                           + now.tv_nsec / 1000000 - start_time.tv_nsec / 1000000);
+                return true;
+            }
+        }
     }
     if (ret == 1) {
         int amount = (int)read(t->fd, buff, 999);
@@ -531,6 +1155,20 @@ bool termpaintx_fd_terminal_size(int fd, int *width, int *height) {
     return true;
 }
 
+int termpaintx_full_integration_output_buffer_high_water_mark(termpaint_integration *integration) {
+    termpaint_integration_fd *t = FDPTR(integration);
+    return (int)t->output_buffer_high_water_mark;
+}
+
+int termpaintx_full_integration_pending_output_bytes(termpaint_integration *integration) {
+    termpaint_integration_fd *t = FDPTR(integration);
+    if (t->async) {
+        size_t pending = t->async_head - atomic_load_explicit(&t->async_tail, memory_order_acquire);
+        return pending > INT_MAX ? INT_MAX : (int)pending;
+    }
+    return (int)t->output_buffer_len;
+}
+
 const struct termios *termpaintx_full_integration_original_terminal_attributes(termpaint_integration *integration) {
     termpaint_integration_fd *t = FDPTR(integration);
     return &t->original_terminal_attributes;
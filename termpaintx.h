@@ -23,12 +23,19 @@ _tERMPAINT_PUBLIC void termpaintx_full_integration_set_terminal(termpaint_integr
 _tERMPAINT_PUBLIC _Bool termpaintx_full_integration_do_iteration(termpaint_integration *integration);
 _tERMPAINT_PUBLIC _Bool termpaintx_full_integration_do_iteration_with_timeout(termpaint_integration *integration, int *milliseconds);
 
+_tERMPAINT_PUBLIC void termpaintx_full_integration_set_frame_interval(termpaint_integration *integration, int milliseconds);
+_tERMPAINT_PUBLIC void termpaintx_full_integration_request_repaint(termpaint_integration *integration);
+_tERMPAINT_PUBLIC int termpaintx_full_integration_repaint_timeout(termpaint_integration *integration);
+
 _tERMPAINT_PUBLIC _Bool termpaintx_full_integration_terminal_size(termpaint_integration *integration, int *width, int *height);
 
 _tERMPAINT_PUBLIC _Bool termpaintx_full_integration_ttyrescue_start(termpaint_integration *integration);
 
 _tERMPAINT_PUBLIC const struct termios *termpaintx_full_integration_original_terminal_attributes(termpaint_integration *integration);
 
+_tERMPAINT_PUBLIC int termpaintx_full_integration_output_buffer_high_water_mark(termpaint_integration *integration);
+_tERMPAINT_PUBLIC int termpaintx_full_integration_pending_output_bytes(termpaint_integration *integration);
+
 _tERMPAINT_PUBLIC _Bool termpaintx_fd_set_termios(int fd, const char *options);
 _tERMPAINT_PUBLIC _Bool termpaintx_fd_terminal_size(int fd, int *width, int *height);
 
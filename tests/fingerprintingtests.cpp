@@ -12,7 +12,7 @@
 
 #define C(name) TERMPAINT_CAPABILITY_ ## name
 
-static const std::array<const char*, 11> allSeq = {
+static const std::array<const char*, 12> allSeq = {
         "\033[>c",
         "\033[>1c",
         "\033[>0;1c",
@@ -24,6 +24,7 @@ static const std::array<const char*, 11> allSeq = {
         "\033[1x",
         "\033]4;255;?\007",
         "\033P+q544e\033\\",
+        "\033[?2026$p",
     };
 
 static std::string TODO = "\x01TODO\x02";
@@ -31,7 +32,8 @@ static std::string TODO = "\x01TODO\x02";
 static const std::vector<int> allCaps = {
     C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE), C(MAY_TRY_CURSOR_SHAPE_BAR), C(CURSOR_SHAPE_OSC50),
     C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED), C(88_COLOR),
-    C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE),
+    C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION),
+    C(SYNCHRONIZED_OUTPUT),
 };
 
 static std::vector<int> allCapsBut(std::initializer_list<int> excluded) {
@@ -78,11 +80,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;128;128;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: xterm(264) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE),
           C(EXTENDED_CHARSET),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -101,11 +104,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: xterm(280) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE),
           C(EXTENDED_CHARSET),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -124,11 +128,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: xterm(336) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -147,11 +152,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: xterm(354) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "XTerm(354)",
         WithoutGlitchPatching
     },
@@ -170,6 +176,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0) safe-CPR seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites.
@@ -193,6 +200,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0) safe-CPR seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites.
@@ -216,6 +224,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites.
@@ -239,6 +248,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites.
@@ -262,6 +272,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites. See above for details
@@ -283,6 +294,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites. See above for details
@@ -304,6 +316,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0) safe-CPR seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites.
@@ -327,6 +340,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0) safe-CPR seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites.
@@ -350,6 +364,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites.
@@ -373,6 +388,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites.
@@ -396,6 +412,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites. See above for details
@@ -417,6 +434,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites. See above for details
@@ -438,6 +456,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;128;128;1;0x", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites. See above for details
@@ -459,6 +478,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;128;128;1;0x", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites. See above for details
@@ -480,6 +500,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;128;128;1;0x", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites. See above for details
@@ -501,6 +522,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;128;128;1;0x", }},
             { "\033]4;255;?\007", { "", }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "\033[?2026;2$y" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         allCapsBut({C(CURSOR_SHAPE_OSC50), C(88_COLOR)}), // should have all compliant capabilites. See above for details
@@ -522,11 +544,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[?x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: vte(2800) safe-CPR seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -545,11 +568,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[?x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: vte(3600) safe-CPR seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -568,11 +592,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[?x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: vte(4000) safe-CPR seq:",
         { C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -591,11 +616,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: vte(5400) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -614,11 +640,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "\033P1+r544e=787465726d2d6b69747479\033\\" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0) safe-CPR seq:>",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         NeedsGlitchPatching
     },
@@ -637,11 +664,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "\033P1+r544e=787465726d2d6b69747479\033\\" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: kitty(14) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -660,6 +688,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: incompatible with input handling(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -683,6 +712,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: incompatible with input handling(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -706,6 +736,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: toodumb(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -729,11 +760,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -752,11 +784,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "fictional",
         WithoutGlitchPatching
     },
@@ -775,6 +808,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: toodumb(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -797,6 +831,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: toodumb(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -820,11 +855,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -843,6 +879,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: misparsing(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -866,11 +903,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -889,11 +927,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -912,11 +951,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "fictional",
         WithoutGlitchPatching
     },
@@ -935,11 +975,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0) safe-CPR seq:>",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         NeedsGlitchPatching
     },
@@ -958,11 +999,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0) safe-CPR seq:>",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         NeedsGlitchPatching
     },
@@ -981,11 +1023,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         NeedsGlitchPatching
     },
@@ -1004,11 +1047,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0) safe-CPR seq:>",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         NeedsGlitchPatching
     },
@@ -1027,11 +1071,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1050,11 +1095,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "fictional",
         WithoutGlitchPatching
     },
@@ -1073,11 +1119,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1096,11 +1143,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1119,6 +1167,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: toodumb(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -1142,6 +1191,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: toodumb(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -1165,11 +1215,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1188,11 +1239,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1211,11 +1263,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;112;112;1;0x" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: konsole(0)  seq:>",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR), C(CURSOR_SHAPE_OSC50),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         NeedsGlitchPatching
     },
@@ -1234,11 +1287,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;112;112;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "\033P1+r544e=6D6C7465726D\033\\" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: mlterm(0) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1257,11 +1311,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1280,11 +1335,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1303,11 +1359,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "fictional",
         WithoutGlitchPatching
     },
@@ -1326,11 +1383,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1349,11 +1407,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;112;112;1;0x" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: screen(30915)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET),
-          C(7BIT_ST) },
+          C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1372,11 +1431,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "\033P0+r\033\\" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: unknown full featured(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1395,11 +1455,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: terminology(0) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1418,11 +1479,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: terminology(1007000) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "terminology 1.7.0",
         WithoutGlitchPatching
     },
@@ -1441,11 +1503,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1464,6 +1527,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: incompatible with input handling(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -1487,11 +1551,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1510,11 +1575,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1533,11 +1599,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: tmux(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1556,11 +1623,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: tmux(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "fictional",
         WithoutGlitchPatching
     },
@@ -1579,11 +1647,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;128;128;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: urxvt(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET),
-          C(CLEARED_COLORING) },
+          C(CLEARED_COLORING), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1602,11 +1671,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;128;128;1;0x" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: urxvt(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(88_COLOR),
-          C(CLEARED_COLORING) },
+          C(CLEARED_COLORING), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1625,11 +1695,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;128;128;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: urxvt(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET),
-          C(CLEARED_COLORING) },
+          C(CLEARED_COLORING), C(SCROLL_REGION) },
         "fictional",
         WithoutGlitchPatching
     },
@@ -1648,11 +1719,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;128;128;1;0x" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: urxvt(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(88_COLOR),
-          C(CLEARED_COLORING) },
+          C(CLEARED_COLORING), C(SCROLL_REGION) },
         "fictional",
         WithoutGlitchPatching
     },
@@ -1671,11 +1743,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1694,11 +1767,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:ee/ee/ed\007" }},
             { "\033P+q544e\033\\",{ "\033P1+r544E=695465726d32\033\\" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: iterm2(0) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1717,11 +1791,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:ee/ee/ed\007" }},
             { "\033P+q544e\033\\",{ "\033P1+r544E=695465726d32\033\\" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: iterm2(3004000) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "iTerm2 3.4.20201030-nightly",
         WithoutGlitchPatching
     },
@@ -1740,11 +1815,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;112;112;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: apple terminal(0)  seq:>",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET),
-          C(7BIT_ST) },
+          C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1763,11 +1839,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;1;1;120;120;1;0x" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\033\\" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: mintty(30200) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(TITLE_RESTORE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(MAY_TRY_TAGGED_PASTE), C(SCROLL_REGION) },
         "mintty 3.2.0",
         WithoutGlitchPatching
     },
@@ -1786,6 +1863,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: incompatible with input handling(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -1809,11 +1887,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ TODO }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1832,11 +1911,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: microsoft terminal(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED), C(TRUECOLOR_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1855,11 +1935,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1878,6 +1959,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: toodumb(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -1901,11 +1983,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0)  seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1924,11 +2007,12 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "\033[3;5;2;64;64;1;0x" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: base(0) safe-CPR seq:>=",
         { C(CSI_POSTFIX_MOD), C(MAY_TRY_CURSOR_SHAPE), C(MAY_TRY_CURSOR_SHAPE_BAR),
           C(EXTENDED_CHARSET), C(TRUECOLOR_MAYBE_SUPPORTED),
-          C(CLEARED_COLORING), C(7BIT_ST) },
+          C(CLEARED_COLORING), C(7BIT_ST), C(SCROLL_REGION) },
         "",
         WithoutGlitchPatching
     },
@@ -1947,6 +2031,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: misparsing(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -1970,6 +2055,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "" }},
             { "\033P+q544e\033\\",{ "", "+q544e" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: misparsing(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
@@ -1993,6 +2079,7 @@ static const std::initializer_list<TestCase> tests = {
             { "\033[1x",          { "" }},
             { "\033]4;255;?\007", { "\033]4;255;rgb:eeee/eeee/eeee\007" }},
             { "\033P+q544e\033\\",{ "" }},
+            { "\033[?2026$p",     { "" }},
         },
         "Type: incompatible with input handling(0)  seq:",
         { C(MAY_TRY_CURSOR_SHAPE_BAR),
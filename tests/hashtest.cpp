@@ -1,6 +1,10 @@
 // SPDX-License-Identifier: BSL-1.0
 #include <stdlib.h>
 
+#include <chrono>
+#include <string>
+#include <vector>
+
 #include "../third-party/catch.hpp"
 
 #include <termpaint_hash.h>
@@ -87,3 +91,121 @@ TEST_CASE("hash: GC") {
     termpaintp_hash_destroy(hash);
     free(hash);
 }
+
+TEST_CASE("hash: GC keeps remaining items reachable") {
+    termpaint_hash* hash = static_cast<termpaint_hash*>(calloc(1, sizeof(termpaint_hash)));
+    hash->item_size = sizeof(termpaint_hash_test);
+    hash->gc_mark_cb = [] (termpaint_hash* h) {
+        for (int i = 0; i < h->allocated; i++) {
+            termpaint_hash_test* item = static_cast<termpaint_hash_test*>(h->slots[i].item);
+            if (item && item->data % 3 == 0) {
+                item->unused = false;
+            }
+        }
+    };
+
+    std::vector<void*> items;
+    for (int i = 0; i < 2000; i++) {
+        std::string str = "gc" + std::to_string(i);
+        termpaint_hash_test* item = static_cast<termpaint_hash_test*>(termpaintp_hash_ensure(hash, u8p(str.data())));
+        REQUIRE(item);
+        item->data = i;
+        items.push_back(item);
+    }
+
+    int found = 0;
+    for (int i = 0; i < 2000; i++) {
+        std::string str = "gc" + std::to_string(i);
+        void* item = termpaintp_hash_get(hash, u8p(str.data()));
+        if (i % 3 == 0) {
+            // kept items never move
+            REQUIRE(item == items[i]);
+        }
+        if (item) {
+            ++found;
+        }
+    }
+    CHECK(found == hash->count);
+
+    termpaintp_hash_destroy(hash);
+    free(hash);
+}
+
+TEST_CASE("hash: throughput", "[!hide][benchmark]") {
+    termpaint_hash* hash = static_cast<termpaint_hash*>(calloc(1, sizeof(termpaint_hash)));
+    hash->item_size = sizeof(termpaint_hash_test);
+
+    std::vector<std::string> keys;
+    for (int i = 0; i < 20000; i++) {
+        // lengths similar to clusters with combining characters and color names
+        keys.push_back(std::string(9 + i % 24, 'a' + i % 26) + std::to_string(i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string &key: keys) {
+        termpaintp_hash_ensure(hash, u8p(key.data()));
+    }
+    auto inserted = std::chrono::steady_clock::now();
+    int hits = 0;
+    for (int round = 0; round < 50; round++) {
+        for (const std::string &key: keys) {
+            hits += termpaintp_hash_get(hash, u8p(key.data())) != nullptr;
+        }
+    }
+    auto done = std::chrono::steady_clock::now();
+    CHECK(hits == 50 * 20000);
+
+    using ns = std::chrono::nanoseconds;
+    WARN("insert: " << std::chrono::duration_cast<ns>(inserted - start).count() / keys.size() << " ns/key, lookup: "
+         << std::chrono::duration_cast<ns>(done - inserted).count() / (50 * keys.size()) << " ns/key");
+
+    termpaintp_hash_destroy(hash);
+    free(hash);
+}
+
+TEST_CASE("hash: slab allocated items") {
+    termpaint_hash* hash = static_cast<termpaint_hash*>(calloc(1, sizeof(termpaint_hash)));
+    hash->item_size = sizeof(termpaint_hash_test);
+    hash->use_slab = true;
+    hash->gc_mark_cb = [] (termpaint_hash* h) {
+        for (int i = 0; i < h->allocated; i++) {
+            termpaint_hash_test* item = static_cast<termpaint_hash_test*>(h->slots[i].item);
+            if (item && item->data % 2 == 0) {
+                item->unused = false;
+            }
+        }
+    };
+
+    std::vector<void*> items;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1000; i++) {
+        // some keys are too long for slab blocks
+        keys.push_back(std::string(i % 150, 'x') + std::to_string(i));
+        termpaint_hash_test* item = static_cast<termpaint_hash_test*>(termpaintp_hash_ensure(hash, u8p(keys[i].data())));
+        REQUIRE(item);
+        CHECK(item->unused == false);
+        item->data = i;
+        items.push_back(item);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        termpaint_hash_test* item = static_cast<termpaint_hash_test*>(termpaintp_hash_get(hash, u8p(keys[i].data())));
+        REQUIRE(item == items[i]);
+        CHECK(item->data == i);
+        CHECK(std::string((const char*)item->text) == keys[i]);
+    }
+
+    termpaintp_hash_clear(hash);
+    CHECK(hash->count == 0);
+    CHECK(termpaintp_hash_get(hash, u8p(keys[0].data())) == nullptr);
+
+    // slab memory is reused after clearing
+    for (int i = 0; i < 100; i++) {
+        termpaint_hash_test* item = static_cast<termpaint_hash_test*>(termpaintp_hash_ensure(hash, u8p(keys[i].data())));
+        REQUIRE(item);
+        CHECK(item->data == 0);
+        CHECK(std::string((const char*)item->text) == keys[i]);
+    }
+
+    termpaintp_hash_destroy(hash);
+    free(hash);
+}
@@ -557,30 +557,31 @@ TEST_CASE("simple patch") {
 }
 
 
-TEST_CASE("too many patches") {
-    // white-box: There is an internal limit of 255 different patch settings at one time.
+TEST_CASE("many patches") {
+    // white-box: Patches are kept in a table that grows as needed and reuses entries no longer used by any cell.
     Fixture f{80, 24};
     termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
 
     termpaint_attr* attr_url = termpaint_attr_new(TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
     using namespace std::literals;
-    std::map<std::tuple<int,int>, Cell> expected;
-    for (int i = 0; i < 256; i++) {
-        const std::string setup = "\033]8;;http://example.com\033\\"s + std::to_string(i);
-        termpaint_attr_set_patch(attr_url, true, setup.data(), "\033]8;;\033\\");
-        termpaint_surface_write_with_attr(f.surface, i % 80, i / 80, "x", attr_url);
-        expected[{i % 80, i / 80}] = singleWideChar("x").withPatch(true, setup, "\033]8;;\033\\");
+    for (int round = 0; round < 3; round++) {
+        std::map<std::tuple<int,int>, Cell> expected;
+        for (int i = 0; i < 80 * 24; i++) {
+            const std::string setup = "\033]8;;http://example.com/"s + std::to_string(round) + "\033\\"s
+                    + std::to_string(i);
+            termpaint_attr_set_patch(attr_url, true, setup.data(), "\033]8;;\033\\");
+            termpaint_surface_write_with_attr(f.surface, i % 80, i / 80, "x", attr_url);
+            expected[{i % 80, i / 80}] = singleWideChar("x").withPatch(true, setup, "\033]8;;\033\\");
+        }
+
+        checkEmptyPlusSome(f.surface, expected);
     }
     termpaint_attr_free(attr_url);
-
-    expected[{255 % 80, 255 / 80}] = singleWideChar("x");
-
-    checkEmptyPlusSome(f.surface, expected);
 }
 
 
 TEST_CASE("many patches - sequential") {
-    // white-box: There is an internal limit of 255 different patch settings at one time.
+    // white-box: Patches no longer used by any cell are released.
     Fixture f{80, 24};
     termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
 
@@ -598,6 +599,92 @@ TEST_CASE("many patches - sequential") {
 }
 
 
+TEST_CASE("long clusters after clear") {
+    // white-box: Clusters longer than 8 bytes are stored separately and released in bulk when clearing.
+    Fixture f{80, 24};
+    usurface_ptr surface = usurface_ptr::take_ownership(termpaint_terminal_new_surface(f.terminal, 20, 4));
+    const std::string cluster = "a\u0308\u0308\u0308\u0308";
+    for (int round = 0; round < 3; round++) {
+        termpaint_surface_clear(surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+        for (int i = 0; i < 20; i++) {
+            std::string text = cluster;
+            for (int j = 0; j < i % 4; j++) {
+                text += "\u0308";
+            }
+            termpaint_surface_write_with_colors(surface, i, round, text.data(),
+                                                TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+        }
+        for (int i = 0; i < 20; i++) {
+            std::string text = cluster;
+            for (int j = 0; j < i % 4; j++) {
+                text += "\u0308";
+            }
+            int len, left, right;
+            const char *peek = termpaint_surface_peek_text(surface, i, round, &len, &left, &right);
+            CHECK(std::string(peek, len) == text);
+        }
+    }
+}
+
+TEST_CASE("many long clusters") {
+    // white-box: Unused clusters longer than 8 bytes are expired incrementally while new ones are written.
+    // That this keeps the storage bounded is checked by termpaintp_test.
+    Fixture f{40, 10};
+    auto utf8 = [] (int codepoint) {
+        std::string ret;
+        ret += (char)(0xc0 | (codepoint >> 6));
+        ret += (char)(0x80 | (codepoint & 0x3f));
+        return ret;
+    };
+    auto clusterFor = [&] (int round, int i) {
+        return std::string(1, (char)('a' + i % 26)) + utf8(0x300 + round % 112) + utf8(0x300 + i % 112)
+                + utf8(0x300 + (i / 112) % 112) + utf8(0x308);
+    };
+    for (int round = 0; round < 40; round++) {
+        for (int i = 0; i < 400; i++) {
+            const std::string text = clusterFor(round, i);
+            termpaint_surface_write_with_colors(f.surface, i % 40, i / 40, text.data(),
+                                                TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+        }
+        termpaint_terminal_flush(f.terminal, false);
+        for (int i = 0; i < 400; i++) {
+            int len, left, right;
+            const char *peek = termpaint_surface_peek_text(f.surface, i % 40, i / 40, &len, &left, &right);
+            REQUIRE(std::string(peek, len) == clusterFor(round, i));
+        }
+    }
+}
+
+TEST_CASE("many styles") {
+    // white-box: Attributes are stored in a style table that expires unused entries incrementally while new ones
+    // are added. Flushing in between makes the collection also cover the copy of the last flushed cells.
+    Fixture f{80, 24};
+    termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 80 * 24; i++) {
+            const unsigned color = TERMPAINT_RGB_COLOR(round * 50, i / 256, i % 256);
+            termpaint_surface_write_with_colors(f.surface, i % 80, i / 80, "x", color, TERMPAINT_DEFAULT_COLOR);
+            if (i % 500 == 499) {
+                termpaint_terminal_flush(f.terminal, false);
+            }
+        }
+        for (int i = 0; i < 80 * 24; i++) {
+            const unsigned color = TERMPAINT_RGB_COLOR(round * 50, i / 256, i % 256);
+            CHECK(termpaint_surface_peek_fg_color(f.surface, i % 80, i / 80) == color);
+            CHECK(termpaint_surface_peek_bg_color(f.surface, i % 80, i / 80) == TERMPAINT_DEFAULT_COLOR);
+        }
+    }
+    termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    for (int i = 0; i < 4096; i++) {
+        termpaint_surface_set_bg_color(f.surface, 0, 0, TERMPAINT_RGB_COLOR(i / 256, i % 256, 0));
+        CHECK(termpaint_surface_peek_bg_color(f.surface, 0, 0) == TERMPAINT_RGB_COLOR(i / 256, i % 256, 0));
+    }
+    checkEmptyPlusSome(f.surface, {
+        {{0, 0}, singleWideChar(TERMPAINT_ERASED).withBg(TERMPAINT_RGB_COLOR(15, 255, 0))}
+    });
+}
+
 TEST_CASE("write with right clipping") {
     Fixture f{80, 24};
     termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
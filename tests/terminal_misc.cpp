@@ -1,8 +1,807 @@
 // SPDX-License-Identifier: BSL-1.0
+#include <atomic>
 #include <random>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "../third-party/catch.hpp"
 
 #include <termpaint.h>
+#include <termpaintx.h>
+
+namespace {
+
+struct RecordingFixture {
+    RecordingFixture(int width, int height) {
+        auto free = [] (termpaint_integration* ptr) {
+            termpaint_integration_deinit(ptr);
+        };
+        auto write = [] (termpaint_integration* ptr, const char *data, int length) {
+            RecordingFixture *self = reinterpret_cast<RecordingFixture*>(ptr);
+            self->writes.emplace_back(data, length);
+        };
+        auto flush = [] (termpaint_integration* ptr) {
+            RecordingFixture *self = reinterpret_cast<RecordingFixture*>(ptr);
+            self->flushes++;
+        };
+        termpaint_integration_init(&integration, free, write, flush);
+        terminal = termpaint_terminal_new(&integration);
+        surface = termpaint_terminal_get_surface(terminal);
+        termpaint_surface_resize(surface, width, height);
+        termpaint_terminal_set_event_cb(terminal, [](void *, termpaint_event *) {}, nullptr);
+    }
+
+    ~RecordingFixture() {
+        termpaint_terminal_free(terminal);
+    }
+
+    void reset() {
+        writes.clear();
+        flushes = 0;
+    }
+
+    std::string output() {
+        std::string ret;
+        for (const auto &s : writes) {
+            ret += s;
+        }
+        return ret;
+    }
+
+    void paintSomething() {
+        termpaint_surface_clear(surface, TERMPAINT_COLOR_BLUE, TERMPAINT_DEFAULT_COLOR);
+        termpaint_attr *attr = termpaint_attr_new(TERMPAINT_COLOR_RED, TERMPAINT_RGB_COLOR(0x12, 0x34, 0x56));
+        termpaint_attr_set_style(attr, TERMPAINT_STYLE_BOLD);
+        for (int y = 0; y < termpaint_surface_height(surface); y += 2) {
+            termpaint_surface_write_with_attr(surface, y % 7, y, "Some text, some more text", attr);
+        }
+        termpaint_attr_free(attr);
+        termpaint_terminal_set_cursor_position(terminal, 3, 4);
+        termpaint_terminal_set_color(terminal, TERMPAINT_COLOR_SLOT_CURSOR, 0x12, 0x34, 0x56);
+    }
+
+    termpaint_integration integration; // must be first member
+    termpaint_terminal *terminal;
+    termpaint_surface *surface;
+    std::vector<std::string> writes;
+    int flushes = 0;
+};
+
+}
+
+TEST_CASE("output buffer: flush is passed to integration in one write") {
+    RecordingFixture f{80, 24};
+    f.paintSomething();
+    f.reset();
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.writes.size() == 1);
+    CHECK(f.flushes == 1);
+}
+
+TEST_CASE("output buffer: output independent of buffer size") {
+    const int size = GENERATE(0, 1, 7, 64, 1000);
+    CAPTURE(size);
+
+    RecordingFixture reference{80, 24};
+    termpaint_terminal_set_output_buffer_size(reference.terminal, 0);
+    reference.paintSomething();
+    reference.reset();
+    termpaint_terminal_flush(reference.terminal, false);
+
+    RecordingFixture f{80, 24};
+    termpaint_terminal_set_output_buffer_size(f.terminal, size);
+    f.paintSomething();
+    f.reset();
+    termpaint_terminal_flush(f.terminal, false);
+
+    CHECK(f.output() == reference.output());
+    CHECK(f.flushes == 1);
+    if (size > 1) {
+        CHECK(f.writes.size() < reference.writes.size());
+    }
+    if (size >= 64) {
+        for (const auto &s : f.writes) {
+            CHECK(s.size() <= static_cast<size_t>(size));
+        }
+    }
+}
+
+TEST_CASE("output buffer: nothing is held back after flush") {
+    RecordingFixture f{20, 5};
+    f.paintSomething();
+    termpaint_terminal_flush(f.terminal, false);
+    f.reset();
+    // functions outside of flush write directly
+    termpaint_terminal_bell(f.terminal);
+    CHECK(f.output() == "\a");
+    CHECK(f.flushes == 1);
+}
+
+TEST_CASE("flush to buffer: frame is returned instead of written") {
+    RecordingFixture reference{80, 24};
+    reference.paintSomething();
+    reference.reset();
+    termpaint_terminal_flush(reference.terminal, false);
+
+    RecordingFixture f{80, 24};
+    f.paintSomething();
+    f.reset();
+    const char *data = nullptr;
+    size_t len = 0;
+    termpaint_terminal_flush_to_buffer(f.terminal, false, &data, &len);
+    CHECK(f.writes.size() == 0);
+    CHECK(f.flushes == 0);
+    REQUIRE(data != nullptr);
+    CHECK(std::string(data, len) == reference.output());
+
+    // the buffer is reused for the next frame
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "x", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush_to_buffer(f.terminal, false, &data, &len);
+    CHECK(std::string(data, len) == "\033[?25l\033[H\033[0mx\033[25C\033[34m\033[K\033[5;4H\033[?25h\033[m");
+    CHECK(f.writes.size() == 0);
+
+    // output outside of flush still goes to the integration
+    termpaint_terminal_bell(f.terminal);
+    CHECK(f.output() == "\a");
+}
+
+TEST_CASE("dirty rows: unchanged rows are skipped") {
+    RecordingFixture f{80, 24};
+    for (int y = 0; y < 24; y++) {
+        termpaint_surface_write_with_colors(f.surface, 0, y, "some text", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    }
+    termpaint_terminal_flush(f.terminal, false);
+
+    f.reset();
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\r\033[23B\033[?25h\033[m");
+
+    f.reset();
+    termpaint_surface_write_with_colors(f.surface, 70, 10, "12:00", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\033[11;71H\033[0;31m12:00\033[C\033[0m\033[K\r\033[13B\033[?25h\033[m");
+}
+
+TEST_CASE("dirty rows: rows redrawn with the same contents are skipped") {
+    RecordingFixture f{80, 24};
+    auto draw = [&f] (const char *clock) {
+        termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+        for (int y = 0; y < 24; y++) {
+            termpaint_surface_write_with_colors(f.surface, 0, y, "some text \xe3\x81\x82 wide",
+                                                TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+        }
+        termpaint_surface_write_with_colors(f.surface, 70, 10, clock, TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    };
+    draw("12:00");
+    termpaint_terminal_flush(f.terminal, false);
+
+    f.reset();
+    draw("12:00");
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\r\033[23B\033[?25h\033[m");
+    CHECK(termpaint_terminal_flush_stats(f.terminal)->rows_skipped == 24);
+    CHECK(termpaint_terminal_flush_stats(f.terminal)->cells_scanned == 0);
+
+    f.reset();
+    draw("12:01");
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\033[11;75H\033[0;31m1\033[C\033[0m\033[K\r\033[13B\033[?25h\033[m");
+    CHECK(termpaint_terminal_flush_stats(f.terminal)->rows_skipped == 23);
+}
+
+TEST_CASE("dirty rows: unchanged cells around changes are skipped") {
+    RecordingFixture f{140, 3};
+    std::string line;
+    for (int i = 0; i < 30; i++) {
+        line += "ab\xe3\x81\x82";
+    }
+    termpaint_surface_write_with_colors(f.surface, 0, 1, line.c_str(), TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+
+    f.reset();
+    termpaint_surface_write_with_colors(f.surface, 0, 1, line.c_str(), TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 1, 1, "x", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 100, 1, "y", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 119, 1, "\xe3\x81\x84", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\n\033[C\033[0;31mx\033[98Cy\033[17C \xe3\x81\x84\033[C\033[0m\033[K\r\n"
+                        "\033[?25h\033[m");
+}
+
+TEST_CASE("double buffering: surface contents are swapped with the last flush") {
+    RecordingFixture f{20, 3};
+    termpaint_terminal_set_double_buffered(f.terminal, true);
+    auto text_at = [&f] (int x, int y) {
+        int len, left, right;
+        const char *text = termpaint_surface_peek_text(f.surface, x, y, &len, &left, &right);
+        return std::string(text, len);
+    };
+
+    termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 0, 1, "frame 1", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    // the surface now has the contents from before the flush
+    CHECK(text_at(0, 1) == TERMPAINT_ERASED);
+
+    f.reset();
+    termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 0, 1, "frame 2", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\n\033[6C\033[0;31m2\033[C\033[0m\033[K\r\n\033[?25h\033[m");
+    CHECK(text_at(0, 1) == "f");
+    CHECK(text_at(6, 1) == "1");
+
+    // flushing only a rectangle does not swap
+    f.reset();
+    termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 0, 1, "frame 3", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush_rect(f.terminal, 0, 1, 20, 1);
+    CHECK(f.output() == "\033[?25l\033[H\n\033[6C\033[0;31m3\033[C\033[0m\033[K\033[12C\033[?25h\033[m");
+    CHECK(text_at(6, 1) == "3");
+
+    f.reset();
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\r\n\n\033[?25h\033[m");
+    CHECK(text_at(6, 1) == "3");
+}
+
+TEST_CASE("flush stats") {
+    RecordingFixture f{80, 24};
+    std::vector<termpaint_flush_stats> reported;
+    termpaint_terminal_set_flush_stats_cb(f.terminal, [](void *user_data, const termpaint_flush_stats *stats) {
+        static_cast<std::vector<termpaint_flush_stats>*>(user_data)->push_back(*stats);
+    }, &reported);
+
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "some text", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    f.reset();
+
+    termpaint_surface_write_with_colors(f.surface, 70, 10, "12:00", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+
+    const termpaint_flush_stats *stats = termpaint_terminal_flush_stats(f.terminal);
+    REQUIRE(reported.size() == 2);
+    CHECK(memcmp(&reported[1], stats, sizeof(*stats)) == 0);
+
+    CHECK(stats->rows_skipped == 23);
+    CHECK(stats->cells_scanned == 80);
+    CHECK(stats->cells_painted >= 5);
+    CHECK(stats->attribute_changes >= 1);
+    CHECK(stats->cursor_moves >= 1);
+    CHECK(stats->bytes_text >= 5);
+    CHECK(stats->bytes_sgr >= (int)strlen("\033[0;31m"));
+    CHECK(stats->bytes_movement >= (int)strlen("\033[H\033[11;71H"));
+    CHECK(stats->bytes_misc >= (int)strlen("\033[?25l\033[?25h\033[m"));
+    CHECK(stats->bytes_text + stats->bytes_sgr + stats->bytes_movement + stats->bytes_misc
+          == (int)f.output().size());
+    // the test integration has no clock
+    CHECK(stats->paint_time_ns == 0);
+    CHECK(stats->write_time_ns == 0);
+
+    termpaint_terminal_set_flush_stats_cb(f.terminal, nullptr, nullptr);
+    f.reset();
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(reported.size() == 2);
+    CHECK(stats->rows_skipped == 24);
+    CHECK(stats->cells_scanned == 0);
+    CHECK(stats->cells_painted == 0);
+    CHECK(stats->bytes_text + stats->bytes_sgr + stats->bytes_movement + stats->bytes_misc
+          == (int)f.output().size());
+}
+
+TEST_CASE("dirty rows: capability changes compare all rows again") {
+    RecordingFixture f{20, 3};
+    termpaint_surface_write_with_colors(f.surface, 0, 1, "text", TERMPAINT_RGB_COLOR(0xff, 0, 0), TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output().find("38;2;255;0;0") != std::string::npos);
+
+    f.reset();
+    termpaint_terminal_disable_capability(f.terminal, TERMPAINT_CAPABILITY_TRUECOLOR_MAYBE_SUPPORTED);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output().find("38;5;196") != std::string::npos);
+}
+
+TEST_CASE("sgr: only changed attributes are sent") {
+    RecordingFixture f{20, 2};
+    termpaint_attr *keyword = termpaint_attr_new(TERMPAINT_COLOR_BLUE, TERMPAINT_DEFAULT_COLOR);
+    termpaint_attr_set_style(keyword, TERMPAINT_STYLE_BOLD);
+    termpaint_attr *plain = termpaint_attr_new(TERMPAINT_COLOR_BLUE, TERMPAINT_DEFAULT_COLOR);
+    termpaint_attr *string = termpaint_attr_new(TERMPAINT_RGB_COLOR(0x80, 0x10, 0x10), TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_attr(f.surface, 0, 0, "int", keyword);
+    termpaint_surface_write_with_attr(f.surface, 3, 0, " x", plain);
+    termpaint_surface_write_with_attr(f.surface, 5, 0, "\"s\"", string);
+    termpaint_surface_write_with_attr(f.surface, 0, 1, "if", keyword);
+    termpaint_attr_free(keyword);
+    termpaint_attr_free(plain);
+    termpaint_attr_free(string);
+
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\033[0;34;1mint\033[22m x\033[38;2;128;16;16m\"s\"\033[0m\033[K\r\n"
+                        "\033[34;1mif\033[0m\033[K\033[18C\033[?25h\033[m");
+}
+
+TEST_CASE("cursor movement: sparse updates use the cheapest movement") {
+    RecordingFixture f{80, 24};
+    for (int y = 0; y < 24; y++) {
+        termpaint_surface_write_with_colors(f.surface, 0, y, ("line " + std::to_string(y) + " text").c_str(),
+                                            TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    }
+    termpaint_terminal_flush(f.terminal, false);
+
+    f.reset();
+    termpaint_surface_write_with_colors(f.surface, 0, 5, "X", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 60, 5, "Y", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 3, 6, "Z", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 2, 20, "W", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    // absolute positioning, cursor forward, reprinting skipped cells and absolute positioning again
+    CHECK(f.output() == "\033[?25l\033[H\033[5B\033[0mX\033[59CY\r\nlinZ\033[21;3HW\r\n\n\n\033[?25h\033[m");
+
+    f.reset();
+    termpaint_surface_write_with_colors(f.surface, 40, 12, "V", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_set_cursor_position(f.terminal, 10, 2);
+    termpaint_terminal_flush(f.terminal, false);
+    // no relative movement to the end of the screen when the cursor is placed explicitly
+    CHECK(f.output() == "\033[?25l\033[H\033[13;41H\033[0mV\033[3;11H\033[?25h\033[m");
+}
+
+
+TEST_CASE("cursor movement: line feeds keep the column") {
+    RecordingFixture f{120, 24};
+    for (int y = 0; y < 24; y++) {
+        termpaint_surface_write_with_colors(f.surface, 0, y, ("line " + std::to_string(y) + " text").c_str(),
+                                            TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    }
+    termpaint_terminal_flush(f.terminal, false);
+
+    f.reset();
+    termpaint_surface_write_with_colors(f.surface, 60, 5, "X", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 55, 6, "Y", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 115, 8, "Z", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 5, 9, "W", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    // absolute positioning, line feed with cursor backward, line feeds with cursor forward and line feed with cursor
+    // character absolute
+    CHECK(f.output() == "\033[?25l\033[H\033[6;61H\033[0mX\n\033[6DY\n\n\033[59CZ\n\033[6GW\r\033[14B\033[?25h\033[m");
+}
+
+TEST_CASE("cursor movement: sparse updates output size", "[!hide][benchmark]") {
+    // a status display where a few random cells change per frame
+    RecordingFixture f{120, 40};
+    for (int y = 0; y < 40; y++) {
+        termpaint_surface_write_with_colors(f.surface, 0, y, ("row " + std::to_string(y) + " some status text here").c_str(),
+                                            TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    }
+    termpaint_terminal_flush(f.terminal, false);
+
+    size_t bytes = 0;
+    std::mt19937 rng(1);
+    for (int frame = 0; frame < 2000; frame++) {
+        f.reset();
+        for (int i = 0; i < 6; i++) {
+            const int x = rng() % 120;
+            const int y = rng() % 40;
+            termpaint_surface_write_with_colors(f.surface, x, y, std::string(1, 'a' + rng() % 26).c_str(),
+                                                TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+        }
+        termpaint_terminal_flush(f.terminal, false);
+        bytes += f.output().size();
+    }
+
+    WARN("sparse updates: " << bytes << " bytes in 2000 frames, " << bytes / 2000 << " bytes/frame");
+}
+
+TEST_CASE("flush cursor: only cursor state is sent") {
+    RecordingFixture f{80, 24};
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "text", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+
+    f.reset();
+    termpaint_surface_write_with_colors(f.surface, 0, 1, "not yet", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_set_cursor_position(f.terminal, 4, 2);
+    termpaint_terminal_flush_cursor(f.terminal);
+    CHECK(f.output() == "\033[3;5H\033[?25h");
+    CHECK(f.flushes == 1);
+
+    f.reset();
+    termpaint_terminal_set_cursor_visible(f.terminal, false);
+    termpaint_terminal_flush_cursor(f.terminal);
+    CHECK(f.output() == "\033[3;5H\033[?25l");
+
+    f.reset();
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output().find("not yet") != std::string::npos);
+}
+
+TEST_CASE("flush rect: only the region is sent") {
+    RecordingFixture f{80, 24};
+    termpaint_terminal_flush(f.terminal, false);
+
+    f.reset();
+    termpaint_surface_write_with_colors(f.surface, 10, 5, "inside", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 10, 15, "below", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 40, 5, "right", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush_rect(f.terminal, 0, 0, 30, 10);
+    CHECK(f.output() == "\033[?25l\033[H\033[6;11H\033[0minside\r\033[4B\033[?25h\033[m");
+
+    // the rest of the changes is still sent by the next flush
+    f.reset();
+    termpaint_terminal_flush(f.terminal, false);
+    std::string out = f.output();
+    CHECK(out.find("inside") == std::string::npos);
+    CHECK(out.find("right") != std::string::npos);
+    CHECK(out.find("below") != std::string::npos);
+
+    f.reset();
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\r\033[23B\033[?25h\033[m");
+}
+
+static void paintLog(termpaint_surface *surface, int first, int top, int bottom) {
+    for (int y = top; y <= bottom; y++) {
+        termpaint_surface_clear_rect(surface, 0, y, 80, 1, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+        termpaint_surface_write_with_colors(surface, 0, y,
+                                            ("log line " + std::to_string(first + y) + ": some text").c_str(),
+                                            TERMPAINT_COLOR_GREEN, TERMPAINT_DEFAULT_COLOR);
+    }
+}
+
+TEST_CASE("scroll region: scrolled content is moved by the terminal") {
+    RecordingFixture reference{80, 24};
+    RecordingFixture f{80, 24};
+    termpaint_terminal_promise_capability(f.terminal, TERMPAINT_CAPABILITY_SCROLL_REGION);
+    paintLog(reference.surface, 0, 0, 23);
+    termpaint_terminal_flush(reference.terminal, false);
+    paintLog(f.surface, 0, 0, 23);
+    termpaint_terminal_flush(f.terminal, false);
+
+    reference.reset();
+    paintLog(reference.surface, 3, 0, 23);
+    termpaint_terminal_flush(reference.terminal, false);
+    f.reset();
+    paintLog(f.surface, 3, 0, 23);
+    termpaint_terminal_flush(f.terminal, false);
+    std::string out = f.output();
+    CHECK(reference.output().find("\033[3M") == std::string::npos);
+    CHECK(out.find("\033[1H\033[3M") != std::string::npos);
+    CHECK(out.find("\033[r") == std::string::npos);
+    CHECK(out.find("log line 25") != std::string::npos);
+    CHECK(out.find("log line 20") == std::string::npos);
+    CHECK(out.size() < reference.output().size());
+
+    f.reset();
+    paintLog(f.surface, 1, 0, 23);
+    termpaint_terminal_flush(f.terminal, false);
+    out = f.output();
+    CHECK(out.find("\033[1H\033[2L") != std::string::npos);
+    CHECK(out.find("log line 1:") != std::string::npos);
+    CHECK(out.find("log line 2:") != std::string::npos);
+    CHECK(out.find("log line 20") == std::string::npos);
+}
+
+TEST_CASE("scroll region: fixed lines are kept out of the scrolling margins") {
+    RecordingFixture f{80, 24};
+    termpaint_terminal_promise_capability(f.terminal, TERMPAINT_CAPABILITY_SCROLL_REGION);
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "header", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 0, 23, "footer", TERMPAINT_COLOR_RED, TERMPAINT_DEFAULT_COLOR);
+    paintLog(f.surface, 0, 1, 22);
+    termpaint_terminal_flush(f.terminal, false);
+
+    f.reset();
+    paintLog(f.surface, 1, 1, 22);
+    termpaint_terminal_flush(f.terminal, false);
+    std::string out = f.output();
+    CHECK(out.find("\033[2;23r\033[2H\033[1M\033[r") != std::string::npos);
+    CHECK(out.find("log line 23") != std::string::npos);
+    CHECK(out.find("log line 22") == std::string::npos);
+    CHECK(out.find("header") == std::string::npos);
+    CHECK(out.find("footer") == std::string::npos);
+}
+
+TEST_CASE("synchronized output: flush is framed as one update") {
+    RecordingFixture f{20, 2};
+    termpaint_terminal_promise_capability(f.terminal, TERMPAINT_CAPABILITY_SYNCHRONIZED_OUTPUT);
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "ab", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?2026h\033[?25l\033[H\033[0mab\033[K\r\n\033[K\033[20C\033[?25h\033[m\033[?2026l");
+
+    f.reset();
+    termpaint_terminal_disable_capability(f.terminal, TERMPAINT_CAPABILITY_SYNCHRONIZED_OUTPUT);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output().find("\033[?2026") == std::string::npos);
+}
+
+TEST_CASE("run length: repeated characters are sent with REP") {
+    RecordingFixture f{40, 1};
+    termpaint_terminal_promise_capability(f.terminal, TERMPAINT_CAPABILITY_REPEAT_CHAR);
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "[", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 1, 0, "====================", TERMPAINT_COLOR_GREEN, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_colors(f.surface, 21, 0, "──]", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\033[0m[\033[32m=\033[19b\033[0m──]\033[K\033[16C\033[?25h\033[m");
+
+    // only cells that changed are part of the run
+    f.reset();
+    termpaint_surface_write_with_colors(f.surface, 11, 0, "##########", TERMPAINT_COLOR_GREEN, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\033[11C\033[0;32m#\033[9b\033[4C\033[0m\033[K\033[15C\033[?25h\033[m");
+}
+
+TEST_CASE("run length: interior blank runs are sent with ECH") {
+    RecordingFixture f{40, 1};
+    termpaint_terminal_promise_capability(f.terminal, TERMPAINT_CAPABILITY_ERASE_CHAR);
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "a", TERMPAINT_DEFAULT_COLOR, TERMPAINT_COLOR_BLUE);
+    termpaint_surface_clear_rect(f.surface, 1, 0, 30, 1, TERMPAINT_DEFAULT_COLOR, TERMPAINT_COLOR_BLUE);
+    termpaint_surface_write_with_colors(f.surface, 31, 0, "b", TERMPAINT_DEFAULT_COLOR, TERMPAINT_COLOR_BLUE);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\033[0;44ma\033[30X\033[30Cb\033[0m\033[K\033[8C\033[?25h\033[m");
+
+    // short runs are cheaper to send as spaces
+    f.reset();
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "x  y", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(f.output() == "\033[?25l\033[H\033[0mx  y\033[36C\033[?25h\033[m");
+}
+
+TEST_CASE("low bandwidth: output is degraded while the output rate is limited") {
+    RecordingFixture f{20, 1};
+    termpaint_terminal_promise_capability(f.terminal, TERMPAINT_CAPABILITY_TRUECOLOR_SUPPORTED);
+    termpaint_terminal_set_low_bandwidth_threshold(f.terminal, 125000);
+    termpaint_attr *attr = termpaint_attr_new(TERMPAINT_RGB_COLOR(0xff, 0x80, 0), TERMPAINT_DEFAULT_COLOR);
+    termpaint_attr_set_style(attr, TERMPAINT_STYLE_UNDERLINE);
+    termpaint_attr_set_deco(attr, TERMPAINT_RGB_COLOR(0, 0, 0xff));
+    termpaint_surface_clear(f.surface, TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaint_surface_write_with_attr(f.surface, 0, 0, "x", attr);
+    termpaint_attr_free(attr);
+
+    termpaint_terminal_set_output_rate(f.terminal, 1000000);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK_FALSE(termpaint_terminal_is_low_bandwidth(f.terminal));
+    CHECK(f.output() == "\033[?25l\033[H\033[0;38;2;255;128;0;58:2:0:0:255;4mx\033[0m\033[K\033[19C\033[?25h\033[m");
+
+    f.reset();
+    termpaint_terminal_set_output_rate(f.terminal, 50000);
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK(termpaint_terminal_is_low_bandwidth(f.terminal));
+    CHECK(f.output() == "\033[?25l\033[H\033[0;38;5;208;4mx\033[C\033[0m\033[K\033[18C\033[?25h\033[m");
+
+    // fidelity is restored after the rate stayed above the threshold for a few flushes
+    f.reset();
+    termpaint_terminal_set_output_rate(f.terminal, 0);
+    for (int i = 0; i < 7; i++) {
+        termpaint_terminal_flush(f.terminal, false);
+    }
+    CHECK(termpaint_terminal_is_low_bandwidth(f.terminal));
+    CHECK(f.output().find("38;") == std::string::npos);
+
+    f.reset();
+    termpaint_terminal_flush(f.terminal, false);
+    CHECK_FALSE(termpaint_terminal_is_low_bandwidth(f.terminal));
+    CHECK(f.output() == "\033[?25l\033[H\033[0;38;2;255;128;0;58:2:0:0:255;4mx\033[C\033[0m\033[K\033[18C\033[?25h\033[m");
+}
+
+namespace {
+
+struct FdFixture {
+    FdFixture(const char *options, bool autoClose = true) {
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        int size = 4096;
+        setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        integration = termpaintx_full_integration_from_fd(fds[0], autoClose, options);
+        terminal = termpaint_terminal_new(integration);
+        termpaintx_full_integration_set_terminal(integration, terminal);
+        termpaint_terminal_set_event_cb(terminal, [](void *, termpaint_event *) {}, nullptr);
+        surface = termpaint_terminal_get_surface(terminal);
+        termpaint_surface_resize(surface, 80, 24);
+    }
+
+    ~FdFixture() {
+        if (terminal) {
+            termpaint_terminal_free(terminal);
+        }
+        close(fds[1]);
+    }
+
+    void paintBusyFrame(int seed) {
+        for (int y = 0; y < 24; y++) {
+            for (int x = 0; x < 80; x++) {
+                termpaint_surface_write_with_colors(surface, x, y, "x",
+                                                    TERMPAINT_RGB_COLOR(x, y, seed), TERMPAINT_RGB_COLOR(seed, y, x));
+            }
+        }
+        termpaint_surface_write_with_colors(surface, 60, 23, ("frame " + std::to_string(seed)).c_str(),
+                                            TERMPAINT_COLOR_BLUE, TERMPAINT_COLOR_RED);
+    }
+
+    std::string readAvailable() {
+        std::string ret;
+        char buf[4096];
+        while (true) {
+            ssize_t len = read(fds[1], buf, sizeof(buf));
+            if (len <= 0) {
+                break;
+            }
+            ret.append(buf, len);
+        }
+        return ret;
+    }
+
+    int fds[2];
+    termpaint_integration *integration;
+    termpaint_terminal *terminal;
+    termpaint_surface *surface;
+};
+
+}
+
+TEST_CASE("termpaintx: buffered fd output") {
+    const std::string options = GENERATE(as<std::string>(), "outputbuffer=0", "outputbuffer=100", "", "outputbuffer=100000");
+    CAPTURE(options);
+    FdFixture f{options.c_str()};
+
+    termpaint_terminal_bell(f.terminal);
+    CHECK(f.readAvailable() == "\a");
+
+    termpaint_surface_clear(f.surface, TERMPAINT_COLOR_BLUE, TERMPAINT_COLOR_RED);
+    termpaint_surface_write_with_colors(f.surface, 60, 23, "end of frame", TERMPAINT_COLOR_BLUE, TERMPAINT_COLOR_RED);
+    termpaint_terminal_flush(f.terminal, false);
+    std::string frame = f.readAvailable();
+    CHECK(frame.size() > 100);
+    CHECK(frame.find("end of frame") != std::string::npos);
+    CHECK(frame.substr(frame.size() - 3) == "\033[m");
+
+    if (options != "outputbuffer=0") {
+        CHECK(termpaintx_full_integration_output_buffer_high_water_mark(f.integration) >= static_cast<int>(frame.size()));
+    }
+}
+
+TEST_CASE("termpaintx: iteration fails after the fd is marked bad") {
+    FdFixture f{""};
+    // writing to the closed socket fails with EPIPE instead of killing the test
+    void (*old_handler)(int) = signal(SIGPIPE, SIG_IGN);
+    close(f.fds[1]);
+    f.fds[1] = -1;
+
+    termpaint_terminal_bell(f.terminal);
+    SECTION("without timeout") {
+        CHECK_FALSE(termpaintx_full_integration_do_iteration(f.integration));
+    }
+    SECTION("with timeout") {
+        int timeout = 10000;
+        CHECK_FALSE(termpaintx_full_integration_do_iteration_with_timeout(f.integration, &timeout));
+        CHECK(timeout == 10000);
+    }
+    signal(SIGPIPE, old_handler);
+}
+
+TEST_CASE("termpaintx: non blocking output is queued") {
+    FdFixture f{"+nonblocking", false};
+
+    CHECK((fcntl(f.fds[0], F_GETFL) & O_NONBLOCK) != 0);
+
+    for (int i = 0; i < 5; i++) {
+        f.paintBusyFrame(i);
+        termpaint_terminal_flush(f.terminal, true);
+    }
+
+    const int pending = termpaintx_full_integration_pending_output_bytes(f.integration);
+    CHECK(pending > 0);
+
+    std::string output;
+    for (int i = 0; i < 10000 && termpaintx_full_integration_pending_output_bytes(f.integration); i++) {
+        output += f.readAvailable();
+        int timeout = 10;
+        REQUIRE(termpaintx_full_integration_do_iteration_with_timeout(f.integration, &timeout));
+    }
+    output += f.readAvailable();
+
+    CHECK(termpaintx_full_integration_pending_output_bytes(f.integration) == 0);
+    CHECK(output.find("frame 3") != std::string::npos);
+    CHECK(output.find("frame 4") != std::string::npos);
+    CHECK(output.substr(output.size() - 3) == "\033[m");
+
+    termpaint_terminal_free(f.terminal);
+    f.terminal = nullptr;
+    CHECK((fcntl(f.fds[0], F_GETFL) & O_NONBLOCK) == 0);
+    close(f.fds[0]);
+}
+
+TEST_CASE("termpaintx: asynchronous output is written by the writer thread") {
+    FdFixture f{"+asyncwrite asyncbuffer=1048576"};
+
+    // 5 full frames do not fit into the socket buffer, but into the ring buffer of the writer thread
+    for (int i = 0; i < 5; i++) {
+        f.paintBusyFrame(i);
+        termpaint_terminal_flush(f.terminal, true);
+    }
+    CHECK(termpaintx_full_integration_pending_output_bytes(f.integration) > 0);
+
+    std::string output;
+    for (int i = 0; i < 10000 && termpaintx_full_integration_pending_output_bytes(f.integration); i++) {
+        output += f.readAvailable();
+        usleep(1000);
+    }
+    output += f.readAvailable();
+
+    CHECK(termpaintx_full_integration_pending_output_bytes(f.integration) == 0);
+    CHECK(output.find("frame 0") != std::string::npos);
+    CHECK(output.find("frame 4") != std::string::npos);
+    CHECK(output.find("frame 3") < output.find("frame 4"));
+    CHECK(output.substr(output.size() - 3) == "\033[m");
+    CHECK(termpaintx_full_integration_output_buffer_high_water_mark(f.integration) > 4096);
+}
+
+TEST_CASE("termpaintx: scheduled repaint waits for the writer thread without polling") {
+    FdFixture f{"+asyncwrite asyncbuffer=1048576"};
+
+    for (int i = 0; i < 5; i++) {
+        f.paintBusyFrame(i);
+        termpaint_terminal_flush(f.terminal, true);
+    }
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "repainted", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaintx_full_integration_request_repaint(f.integration);
+    CHECK(termpaintx_full_integration_repaint_timeout(f.integration) == -1);
+
+    std::atomic<bool> repainted{false};
+    std::thread reader([&] {
+        std::string output;
+        for (int i = 0; i < 10000 && !repainted; i++) {
+            output += f.readAvailable();
+            repainted = output.find("repainted") != std::string::npos;
+            usleep(1000);
+        }
+    });
+
+    // the writer thread wakes up the iteration once the earlier frames are written
+    int iterations = 0;
+    for (int i = 0; i < 100 && !repainted; i++) {
+        int timeout = 100;
+        REQUIRE(termpaintx_full_integration_do_iteration_with_timeout(f.integration, &timeout));
+        iterations++;
+    }
+    reader.join();
+    CHECK(repainted);
+    CHECK(iterations < 10);
+}
+
+TEST_CASE("termpaintx: scheduled repaints are rate limited") {
+    FdFixture f{""};
+    termpaintx_full_integration_set_frame_interval(f.integration, 200);
+
+    CHECK(termpaintx_full_integration_repaint_timeout(f.integration) == -1);
+
+    termpaint_surface_write_with_colors(f.surface, 0, 0, "first", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaintx_full_integration_request_repaint(f.integration);
+    CHECK(termpaintx_full_integration_repaint_timeout(f.integration) == 0);
+    int timeout = 0;
+    REQUIRE(termpaintx_full_integration_do_iteration_with_timeout(f.integration, &timeout));
+    CHECK(f.readAvailable().find("first") != std::string::npos);
+    CHECK(termpaintx_full_integration_repaint_timeout(f.integration) == -1);
+
+    // both changes are coalesced into one flush after the frame interval
+    termpaint_surface_write_with_colors(f.surface, 0, 1, "second", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaintx_full_integration_request_repaint(f.integration);
+    termpaint_surface_write_with_colors(f.surface, 0, 2, "third", TERMPAINT_DEFAULT_COLOR, TERMPAINT_DEFAULT_COLOR);
+    termpaintx_full_integration_request_repaint(f.integration);
+    CHECK(termpaintx_full_integration_repaint_timeout(f.integration) > 0);
+    timeout = 0;
+    REQUIRE(termpaintx_full_integration_do_iteration_with_timeout(f.integration, &timeout));
+    CHECK(f.readAvailable() == "");
 
+    timeout = 10000;
+    REQUIRE(termpaintx_full_integration_do_iteration_with_timeout(f.integration, &timeout));
+    CHECK(timeout > 0);
+    std::string output = f.readAvailable();
+    CHECK(output.find("second") != std::string::npos);
+    CHECK(output.find("third") != std::string::npos);
+    CHECK(termpaintx_full_integration_repaint_timeout(f.integration) == -1);
+}
@@ -18,6 +18,7 @@ import_whitelist_main = [
     'memcmp',
     'memcpy', '__memcpy_chk',
     'memmove', '__memmove_chk',
+    'memset', '__memset_chk',
     'realloc',
     'sprintf', '__sprintf_chk',
     'strchr',
@@ -54,9 +55,25 @@ import_whitelist_x = [
     'tcgetattr',
     'tcsetattr',
     'write',
+    'writev',
+  # C99
+    'strtol',
   # other
     'ioctl', # used with TIOCGWINSZ
 
+  # +asyncwrite writer thread (POSIX threads)
+    'pthread_cond_broadcast',
+    'pthread_cond_destroy',
+    'pthread_cond_init',
+    'pthread_cond_wait',
+    'pthread_create',
+    'pthread_join',
+    'pthread_mutex_destroy',
+    'pthread_mutex_init',
+    'pthread_mutex_lock',
+    'pthread_mutex_unlock',
+    'pthread_sigmask',
+
   # rescue (POSIX.1-2001)
     'getenv',
     'sigprocmask',